@@ -0,0 +1,295 @@
+#include "BLE.h"
+#include "UART.h"
+#include "SysTimer.h"
+#include "power.h"
+#include "softtimer.h"
+#include <stdio.h>
+#include <string.h>
+
+// Console output stage for the HM-10 link.
+// Characters are queued and sent in BLE_MTU sized chunks so each BLE
+// notification carries as many bytes as possible. A chunk is sent when it
+// fills, on newline, or after BLE_IDLE_FLUSH_MS without new output; the
+// idle flush timer is armed only while a partial chunk waits. Chunks
+// are paced against an estimate of the module's buffer so nothing is
+// dropped. Only thread code sends, one chunk at a time: output queued from
+// an interrupt, or while a chunk is on its way, goes out with the next one.
+
+static char queue[BLE_TX_QUEUE];
+static volatile uint32_t head, tail;
+static volatile uint8_t sending;
+static volatile uint32_t lastPut;  // tick of the last queued character
+static uint32_t overflows;         // characters dropped in interrupts on a full queue
+static SoftTimer flushTimer;       // idle flush, armed while the queue is not empty
+static volatile uint8_t flushArmed;
+
+static uint32_t inFlight;          // estimated bytes still buffered in the module
+static uint32_t lastDrain;         // tick inFlight was last brought up to date
+static uint32_t bytesSent, chunksSent;
+
+// HM-10 AT+BAUD parameter is the index into this table
+static const uint32_t HM10_BAUD[] = {
+	9600U, 19200U, 38400U, 57600U, 115200U, 4800U, 2400U, 1200U, 230400U
+};
+
+static uint32_t currentBaud = USART_BAUD_DEFAULT;
+static uint32_t fallbackBaud;      // rate to return to if the new one is not confirmed
+static SoftTimer fallbackTimer;
+
+// Account for the chunks the module has sent over the air since last time
+static void BLE_Drain(void) {
+	uint32_t intervals = (SysTick_GetTick() - lastDrain) / BLE_CONN_INTERVAL_MS;
+
+	if (intervals == 0) return;
+	lastDrain += intervals * BLE_CONN_INTERVAL_MS;
+	if (inFlight > intervals * BLE_MTU) {
+		inFlight -= intervals * BLE_MTU;
+	} else {
+		inFlight = 0;
+	}
+}
+
+static void BLE_Send(char* data, uint8_t len) {
+	BLE_Drain();
+	while (inFlight + len > BLE_MODULE_BUFFER) { // wait for room in the module
+		Power_Sleep(); // until the next SysTick
+		BLE_Drain();
+	}
+	if (inFlight == 0) lastDrain = SysTick_GetTick(); // the module drains no sooner than one interval from now
+	USART_Write(USART1, (uint8_t *)data, len);
+	inFlight += len;
+	bytesSent += len;
+	chunksSent++;
+}
+
+// Bytes that would go out without BLE_Send waiting for room
+uint32_t BLE_Room(void) {
+	BLE_Drain();
+	return inFlight < BLE_MODULE_BUFFER ? BLE_MODULE_BUFFER - inFlight : 0;
+}
+
+// A reply of one chunk would go out without BLE_Send waiting for room
+uint8_t BLE_Writable(void) {
+	return BLE_Room() >= BLE_MTU;
+}
+
+// Move the next chunk, up to a newline or BLE_MTU bytes, to out. A shorter
+// chunk stays queued unless partial is set.
+static uint8_t BLE_Take(char* out, uint8_t partial) {
+	uint8_t len = 0;
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	while (head - tail > len && len < BLE_MTU) {
+		out[len] = queue[(tail + len) & (BLE_TX_QUEUE - 1)];
+		if (out[len++] == '\n') break;
+	}
+	if (len != 0 && (partial || len == BLE_MTU || out[len - 1] == '\n')) {
+		tail += len;
+	} else {
+		len = 0;
+	}
+	__set_PRIMASK(primask);
+	return len;
+}
+
+// Send the complete chunks, and the last partial one too if partial is set
+static void BLE_Pump(uint8_t partial) {
+	char out[BLE_MTU];
+	uint8_t len;
+	uint32_t primask;
+
+	if (__get_IPSR() != 0) return; // interrupts never wait for the link
+	primask = __get_PRIMASK();
+	__disable_irq();
+	if (sending) { // an interrupted send picks this up
+		__set_PRIMASK(primask);
+		return;
+	}
+	sending = 1;
+	__set_PRIMASK(primask);
+
+	while ((len = BLE_Take(out, partial)) != 0) {
+		BLE_Send(out, len);
+	}
+	__disable_irq();
+	sending = 0;
+	if (head == tail && flushArmed) { // nothing left to flush
+		SoftTimer_Stop(&flushTimer);
+		flushArmed = 0;
+	}
+	__set_PRIMASK(primask);
+}
+
+// Idle flush timer, from SoftTimer_Dispatch: send the partial chunk once
+// the output has been quiet for BLE_IDLE_FLUSH_MS
+static void BLE_IdleFlush(void* context) {
+	uint32_t quiet;
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	quiet = SysTick_GetTick() - lastPut;
+	flushArmed = head != tail && quiet < BLE_IDLE_FLUSH_MS;
+	if (flushArmed) SoftTimer_Start(&flushTimer, BLE_IDLE_FLUSH_MS - quiet, 0, BLE_IdleFlush, NULL);
+	__set_PRIMASK(primask);
+	if (!flushArmed) BLE_Flush();
+}
+
+void BLE_Putc(char c) {
+	uint32_t primask;
+
+	for (;;) {
+		primask = __get_PRIMASK();
+		__disable_irq();
+		if (head - tail < BLE_TX_QUEUE) {
+			queue[head & (BLE_TX_QUEUE - 1)] = c;
+			head++;
+			lastPut = SysTick_GetTick();
+			if (!flushArmed) {
+				flushArmed = 1;
+				SoftTimer_Start(&flushTimer, BLE_IDLE_FLUSH_MS, 0, BLE_IdleFlush, NULL);
+			}
+			__set_PRIMASK(primask);
+			break;
+		}
+		__set_PRIMASK(primask);
+		if (__get_IPSR() != 0 || sending) { // cannot wait for room here
+			overflows++;
+			return;
+		}
+		BLE_Pump(1);
+	}
+	if (c == '\n' || head - tail >= BLE_MTU) BLE_Pump(0);
+}
+
+void BLE_Flush(void) {
+	BLE_Pump(1);
+}
+
+// AT+BAUD parameter for baud, -1 if the module or USART1 cannot use it
+// (230400 is 2.1% off at the 4 MHz idle clock)
+static int8_t BLE_BaudCode(uint32_t baud) {
+	int8_t i;
+	if (!USART_BaudSupported(baud)) return -1;
+	for (i = 0; i < (int8_t)(sizeof(HM10_BAUD) / sizeof(HM10_BAUD[0])); i++) {
+		if (HM10_BAUD[i] == baud) return i;
+	}
+	return -1;
+}
+
+// Send an AT command to the module and collect its reply until the line goes quiet.
+// The console ISR must be disabled so the reply is not taken for a command.
+static uint8_t BLE_AT(const char* cmd, char* reply, uint8_t size) {
+	uint8_t c, len = 0;
+
+	USART1->ICR = USART_ICR_ORECF; // a stale overrun would block reception
+	USART_Write(USART1, (uint8_t *)cmd, strlen(cmd));
+	if (USART_ReadTimeout(USART1, &c, BLE_AT_TIMEOUT_MS) == 0) {
+		do {
+			if (len < size - 1) reply[len++] = c;
+		} while (USART_ReadTimeout(USART1, &c, BLE_AT_GAP_MS) == 0);
+	}
+	reply[len] = '\0';
+	return len;
+}
+
+// Reprogram the module to baud and follow it with USART1
+static int8_t BLE_Switch(uint32_t baud) {
+	char cmd[16], reply[32];
+	int8_t result = -1;
+
+	NVIC_DisableIRQ(USART1_IRQn);
+	// "AT" drops an active BLE connection so the module accepts commands
+	BLE_AT("AT", reply, sizeof(reply));
+	snprintf(cmd, sizeof(cmd), "AT+BAUD%d", BLE_BaudCode(baud));
+	BLE_AT(cmd, reply, sizeof(reply));
+	if (strstr(reply, "OK+Set") != NULL) {
+		BLE_AT("AT+RESET", reply, sizeof(reply)); // new rate applies after a restart
+		USART_SetBaud(USART1, baud);
+		currentBaud = baud;
+		result = 0;
+	}
+	NVIC_EnableIRQ(USART1_IRQn);
+	return result;
+}
+
+// Probe the module at every rate it supports, called once at boot
+uint32_t BLE_DetectBaud(void) {
+	char reply[32];
+	uint8_t i;
+
+	for (i = 0; i < sizeof(HM10_BAUD) / sizeof(HM10_BAUD[0]); i++) {
+		if (BLE_BaudCode(HM10_BAUD[i]) < 0) continue;
+		USART_SetBaud(USART1, HM10_BAUD[i]);
+		BLE_AT("AT", reply, sizeof(reply));
+		if (strstr(reply, "OK") != NULL) {
+			currentBaud = HM10_BAUD[i];
+			return currentBaud;
+		}
+	}
+	// no answer (module connected or absent), assume the factory default
+	USART_SetBaud(USART1, USART_BAUD_DEFAULT);
+	currentBaud = USART_BAUD_DEFAULT;
+	return 0;
+}
+
+// Take the rate the module was left at without probing it, e.g. after a
+// warm reset that did not power cycle the module
+int8_t BLE_AssumeBaud(uint32_t baud) {
+	if (BLE_BaudCode(baud) < 0) return -1;
+	USART_SetBaud(USART1, baud);
+	currentBaud = baud;
+	return 0;
+}
+
+// No command arrived at the new rate in time, from SoftTimer_Dispatch
+static void BLE_Revert(void* context) {
+	if (BLE_Switch(fallbackBaud) != 0) {
+		// module never took the new rate, only USART1 has to go back
+		USART_SetBaud(USART1, fallbackBaud);
+		currentBaud = fallbackBaud;
+	}
+}
+
+// Nonzero if BLE_SetBaud accepts baud
+uint8_t BLE_BaudValid(uint32_t baud) {
+	return BLE_BaudCode(baud) >= 0;
+}
+
+// Change the link rate. Reverts after BLE_BAUD_CONFIRM_MS unless BLE_Confirm is called.
+int8_t BLE_SetBaud(uint32_t baud) {
+	uint32_t previous = currentBaud;
+
+	if (BLE_BaudCode(baud) < 0) return -1;
+	if (baud == currentBaud) return 0;
+	BLE_Flush();
+	while (inFlight != 0) { // let the module send the reply before the link drops
+		Power_Sleep();
+		BLE_Drain();
+	}
+	if (BLE_Switch(baud) != 0) return -1;
+	fallbackBaud = previous;
+	SoftTimer_Start(&fallbackTimer, BLE_BAUD_CONFIRM_MS, 0, BLE_Revert, NULL);
+	return 0;
+}
+
+uint32_t BLE_GetBaud(void) {
+	return currentBaud;
+}
+
+// Valid traffic arrived at the current rate, keep it
+void BLE_Confirm(void) {
+	SoftTimer_Stop(&fallbackTimer);
+}
+
+uint32_t BLE_GetBytes(void) {
+	return bytesSent;
+}
+
+uint32_t BLE_GetChunks(void) {
+	return chunksSent;
+}
+
+uint32_t BLE_GetOverflows(void) {
+	return overflows;
+}
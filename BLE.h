@@ -0,0 +1,34 @@
+#ifndef __STM32L476R_NUCLEO_BLE_H
+#define __STM32L476R_NUCLEO_BLE_H
+
+#include <stdint.h>
+
+// HM-10 forwards whatever it has buffered as one notification per
+// connection event, 20 bytes max with the default ATT MTU
+#define BLE_MTU               20U
+#define BLE_TX_QUEUE          256U // queued console output, power of 2
+#define BLE_IDLE_FLUSH_MS     10U  // flush a partial chunk after this much quiet
+#define BLE_CONN_INTERVAL_MS  30U  // time the module needs to drain one chunk
+#define BLE_MODULE_BUFFER     80U  // bytes we allow in flight inside the module
+
+#define BLE_AT_TIMEOUT_MS     300U   // wait for the first byte of an AT reply
+#define BLE_AT_GAP_MS         20U    // reply is complete after this much silence
+#define BLE_BAUD_CONFIRM_MS   30000U // revert a BAUD change without traffic in this time
+
+void BLE_Putc(char c);
+void BLE_Flush(void);
+uint8_t BLE_Writable(void);
+uint32_t BLE_Room(void);
+
+uint32_t BLE_DetectBaud(void);
+int8_t BLE_AssumeBaud(uint32_t baud);
+uint8_t BLE_BaudValid(uint32_t baud);
+int8_t BLE_SetBaud(uint32_t baud);
+uint32_t BLE_GetBaud(void);
+void BLE_Confirm(void);
+
+uint32_t BLE_GetBytes(void);
+uint32_t BLE_GetChunks(void);
+uint32_t BLE_GetOverflows(void);
+
+#endif
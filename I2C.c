@@ -1,5 +1,7 @@
 #include "I2C.h"
 #include "SysTimer.h"
+#include "SysClock.h"
+#include "power.h"
 
 // heaviled based off Grenoble-INP France driver for LCD HD44780 driven through PCF8574 expander
 // https://community.st.com/s/question/0D50X00009sUBHFSA4/enpresentationstm32i2clcdhd44780v2
@@ -42,21 +44,31 @@ void I2C_GPIO_Init(void) {
 					 ~GPIO_AFRH_AFSEL9_1 & ~GPIO_AFRH_AFSEL9_3;
 }
 	
-#define I2C_TIMINGR_PRESC_POS	28
-#define I2C_TIMINGR_SCLDEL_POS	20
-#define I2C_TIMINGR_SDADEL_POS	16
-#define I2C_TIMINGR_SCLH_POS	8
-#define I2C_TIMINGR_SCLL_POS	0
+static uint32_t i2cSpeed = I2C_LCD_SPEED;
+
+// I2C1 kernel clock is SYSCLK (I2C1SEL = 01)
+SYSCLOCK_STATIC_ASSERT(I2C_TIMING_OK(SYSCLOCK_IDLE_HZ, I2C_LCD_SPEED, I2C_RISE_NS, I2C_FALL_NS), i2c_idle_timing);
+SYSCLOCK_STATIC_ASSERT(I2C_TIMING_OK(SYSCLOCK_BURST_HZ, I2C_LCD_SPEED, I2C_RISE_NS, I2C_FALL_NS), i2c_burst_timing);
+// Batched LCD writes rely on the bus being slow enough, see LCD_Batch_Send
+SYSCLOCK_STATIC_ASSERT(I2C_LCD_SPEED <= I2C_SPEED_FAST, lcd_batch_speed);
+
+// Waits on the queue run the watchdog, then sleep until the next interrupt
+// (an I2C completion, or SysTick for the watchdog) unless cond already holds
+#define I2C_WAIT(cond) do { I2C_Poll(); POWER_SLEEP_UNLESS(cond); } while (0)
+static I2C_Stats i2cStats;
+
+// Same formulas as I2C_TIMING, evaluated for clocks only known at runtime
+uint32_t I2C_ComputeTiming(uint32_t clk, uint32_t bus, uint32_t tr, uint32_t tf) {
+	return I2C_TIMING(clk, bus, tr, tf);
+}
 
 //===============================================================================
 //                          I2C Initialization
 //===============================================================================
-void I2C_Initialization(void){
+// Reset I2C1 and program it, leaves the peripheral disabled
+static void I2C_Configure(void){
 	uint32_t OwnAddr = 0x52U;
 	
-	RCC->APB1ENR1 |= RCC_APB1ENR1_I2C1EN;
-	RCC->CCIPR |= RCC_CCIPR_I2C1SEL_0;
-	RCC->CCIPR &= ~RCC_CCIPR_I2C1SEL_1;
 	RCC->APB1RSTR1 |= RCC_APB1RSTR1_I2C1RST;
 	RCC->APB1RSTR1 &= ~RCC_APB1RSTR1_I2C1RST;
 	
@@ -69,16 +81,8 @@ void I2C_Initialization(void){
 	I2C1->CR2 &= ~I2C_CR2_ADD10; // 7-bit addressing mode
 	I2C1->CR2 |= I2C_CR2_AUTOEND | I2C_CR2_NACK;
 	
-	// 8 MHz CLK, 125 ns period
-	// SCLDEL - 4.7us setup time
-	// SDADEL - 4.0us hold time
-	// SCLH - 4us high time
-	// SCLL - 4.7us low time
-	I2C1->TIMINGR |= (I2C_TIMINGR_PRESC & (3U << I2C_TIMINGR_PRESC_POS)) |
-					 (I2C_TIMINGR_SCLDEL & (4U << I2C_TIMINGR_SCLDEL_POS)) |
-					 (I2C_TIMINGR_SDADEL & (3U << I2C_TIMINGR_SDADEL_POS)) |
-					 (I2C_TIMINGR_SCLH & (3U << I2C_TIMINGR_SCLH_POS)) |
-					 (I2C_TIMINGR_SCLL & (4U << I2C_TIMINGR_SCLL_POS));
+	// I2C1 kernel clock is SYSCLK (I2C1SEL = 01)
+	I2C1->TIMINGR = I2C_ComputeTiming(SysClock_GetFreq(), i2cSpeed, I2C_RISE_NS, I2C_FALL_NS);
 	
 	I2C1->OAR1 &= ~I2C_OAR1_OA1EN;
 	while ((I2C1->OAR1 & I2C_OAR1_OA1EN) == I2C_OAR1_OA1EN);
@@ -87,155 +91,436 @@ void I2C_Initialization(void){
 	I2C1->OAR1 &= ~I2C_OAR1_OA1MODE;
 	I2C1->OAR1 |= (OwnAddr << 1) & I2C_OAR1_OA1;
 	I2C1->OAR1 |= I2C_OAR1_OA1EN;
+}
+
+static void I2C_ClockChanged(SysClockEvent event);
+
+void I2C_Initialization(void){
+	RCC->APB1ENR1 |= RCC_APB1ENR1_I2C1EN;
+	RCC->CCIPR |= RCC_CCIPR_I2C1SEL_0;
+	RCC->CCIPR &= ~RCC_CCIPR_I2C1SEL_1;
 	
+	I2C_Configure();
 	I2C1->CR1 |= I2C_CR1_PE;
+	SysClock_Register(I2C_ClockChanged);
 }
 
 //===============================================================================
-//                           I2C Start
-// Master generates START condition:
-//    -- Slave address: 7 bits
-//    -- Automatically generate a STOP condition after all bytes have been transmitted 
-// Direction = 0: Master requests a write transfer
-// Direction = 1: Master requests a read transfer
-//=============================================================================== 
-int8_t I2C_Start(I2C_TypeDef * I2Cx, uint32_t DevAddress, uint8_t Size, uint8_t Direction) {
-	
-	// Direction = 0: Master requests a write transfer
-	// Direction = 1: Master requests a read transfer
-	
-	uint32_t tmpreg = 0;
+//                           I2C Speed
+// TIMINGR can only be written while the peripheral is disabled. It is
+// recomputed after every SYSCLK change to keep the bus at I2C_LCD_SPEED.
+//===============================================================================
+static void I2C_ApplyTiming(void) {
+	I2C1->CR1 &= ~I2C_CR1_PE;
+	while ((I2C1->CR1 & I2C_CR1_PE) == I2C_CR1_PE);
+	I2C1->TIMINGR = I2C_ComputeTiming(SysClock_GetFreq(), i2cSpeed, I2C_RISE_NS, I2C_FALL_NS);
+	I2C1->CR1 |= I2C_CR1_PE;
+}
+
+// The queue drains before the switch, so nothing is on the bus after it
+static void I2C_ClockChanged(SysClockEvent event) {
+	if (event == SYSCLOCK_PRE_CHANGE) {
+		while (I2C_Busy()) I2C_WAIT(!I2C_Busy());
+	} else {
+		I2C_ApplyTiming();
+	}
+}
+
+//===============================================================================
+//                           Bus Recovery
+// A slave that lost clocks in the middle of a read holds SDA low forever.
+// SCL is toggled by hand until the slave lets go (9 clocks at most), then
+// a STOP is generated and the peripheral is reset and reprogrammed.
+// Takes about 100 us; interrupts stay enabled.
+//===============================================================================
+static void I2C_HalfBit(void) {
+	volatile uint32_t n = SysClock_GetFreq() / 800000U + 1U; // ~5 us, 4 cycles per pass
+	while (n--);
+}
+
+void I2C_RecoverBus(void) {
+	uint32_t cr1 = I2C1->CR1;
+	uint8_t i;
 	
-	// This bit is set by software, and cleared by hardware after the Start followed by the address
-	// sequence is sent, by an arbitration loss, by a timeout error detection, or when PE = 0.
-	tmpreg = I2Cx->CR2;
+	I2C1->CR1 &= ~I2C_CR1_PE;
 	
-	tmpreg &= (uint32_t)~((uint32_t)(I2C_CR2_SADD | I2C_CR2_NBYTES | I2C_CR2_RELOAD | I2C_CR2_AUTOEND | I2C_CR2_RD_WRN | I2C_CR2_START | I2C_CR2_STOP));
+	// PB8 (SCL) and PB9 (SDA) as open-drain outputs, released high
+	GPIOB->BSRR = GPIO_BSRR_BS8 | GPIO_BSRR_BS9;
+	GPIOB->MODER &= ~GPIO_MODER_MODE8 & ~GPIO_MODER_MODE9;
+	GPIOB->MODER |= GPIO_MODER_MODE8_0 | GPIO_MODER_MODE9_0;
+	I2C_HalfBit();
 	
-	if (Direction == READ_FROM_SLAVE)
-		tmpreg |= I2C_CR2_RD_WRN;  // Read from Slave
-	else
-		tmpreg &= ~I2C_CR2_RD_WRN; // Write to Slave
-		
-	tmpreg |= (uint32_t)(((uint32_t)DevAddress & I2C_CR2_SADD) | (((uint32_t)Size << 16 ) & I2C_CR2_NBYTES));
+	for (i = 0; i < I2C_RECOVERY_CLOCKS && (GPIOB->IDR & GPIO_IDR_ID9) == 0; i++) {
+		GPIOB->BSRR = GPIO_BSRR_BR8;
+		I2C_HalfBit();
+		GPIOB->BSRR = GPIO_BSRR_BS8;
+		I2C_HalfBit();
+	}
 	
-	tmpreg |= I2C_CR2_START;
+	// STOP: SDA rises while SCL is high
+	GPIOB->BSRR = GPIO_BSRR_BR8;
+	I2C_HalfBit();
+	GPIOB->BSRR = GPIO_BSRR_BR9;
+	I2C_HalfBit();
+	GPIOB->BSRR = GPIO_BSRR_BS8;
+	I2C_HalfBit();
+	GPIOB->BSRR = GPIO_BSRR_BS9;
+	I2C_HalfBit();
 	
-	I2Cx->CR2 = tmpreg; 
+	// back to alternate function mode
+	GPIOB->MODER &= ~GPIO_MODER_MODE8_0 & ~GPIO_MODER_MODE9_0;
+	GPIOB->MODER |= GPIO_MODER_MODE8_1 | GPIO_MODER_MODE9_1;
 	
-   	return 0;  // Success
+	I2C_Configure();
+	I2C1->CR1 = cr1; // interrupt and DMA enables, PE
+	i2cStats.recoveries++;
 }
 
 //===============================================================================
-//                           I2C Stop
-//=============================================================================== 
-void I2C_Stop(I2C_TypeDef * I2Cx){
-	// Master: Generate STOP bit after the current byte has been transferred 
-	I2Cx->CR2 |= I2C_CR2_STOP;								
-	// Wait until STOPF flag is reset
-	while( (I2Cx->ISR & I2C_ISR_STOPF) == 0 ); 
+//                      Asynchronous I2C1 transaction queue
+// Transactions are copied into a ring and executed one after another by
+// DMA1 (channel 6 = I2C1_TX, channel 7 = I2C1_RX, request 3) and the I2C1
+// event/error interrupts. Completion callbacks run in interrupt context.
+//===============================================================================
+static I2C_Transaction i2cQueue[I2C_QUEUE_SIZE];
+static volatile uint8_t i2cHead, i2cTail;
+static volatile uint8_t i2cActive;      // transaction at i2cTail is on the bus
+static volatile uint16_t i2cRemaining;  // bytes not yet covered by NBYTES
+static volatile int8_t i2cStatus;
+static volatile uint32_t i2cStart;      // tick the active transaction was started
+static volatile uint32_t i2cTimeout;    // ms it may take before the watchdog steps in
+
+void I2C_DMA_Init(void) {
+	RCC->AHB1ENR |= RCC_AHB1ENR_DMA1EN;
+	
+	// DMA1 channel mapping (Channel 6 and 7 on Request 3)
+	DMA1_CSELR->CSELR &= ~(DMA_CSELR_C6S | DMA_CSELR_C7S);
+	DMA1_CSELR->CSELR |= (3U << 20) | (3U << 24);
+	
+	// Memory -> Peripheral, memory increment, 8-bit
+	DMA1_Channel6->CCR &= ~(DMA_CCR_EN | DMA_CCR_MSIZE | DMA_CCR_PSIZE | DMA_CCR_PINC | DMA_CCR_CIRC);
+	DMA1_Channel6->CCR |= DMA_CCR_DIR | DMA_CCR_MINC;
+	DMA1_Channel6->CPAR = (uint32_t) &(I2C1->TXDR);
+	
+	// Peripheral -> Memory, memory increment, 8-bit
+	DMA1_Channel7->CCR &= ~(DMA_CCR_EN | DMA_CCR_DIR | DMA_CCR_MSIZE | DMA_CCR_PSIZE | DMA_CCR_PINC | DMA_CCR_CIRC);
+	DMA1_Channel7->CCR |= DMA_CCR_MINC;
+	DMA1_Channel7->CPAR = (uint32_t) &(I2C1->RXDR);
+	
+	I2C1->CR1 |= I2C_CR1_TXDMAEN | I2C_CR1_RXDMAEN | I2C_CR1_TCIE | I2C_CR1_STOPIE | I2C_CR1_NACKIE | I2C_CR1_ERRIE;
+	
+	NVIC_SetPriority(I2C1_EV_IRQn, 2);
+	NVIC_SetPriority(I2C1_ER_IRQn, 2);
+	NVIC_EnableIRQ(I2C1_EV_IRQn);
+	NVIC_EnableIRQ(I2C1_ER_IRQn);
 }
 
-//===============================================================================
-//                           Wait for the bus is ready
-//=============================================================================== 
-void I2C_WaitLineIdle(I2C_TypeDef * I2Cx){
-	// Wait until I2C bus is ready
-	while( (I2Cx->ISR & I2C_ISR_BUSY) == I2C_ISR_BUSY );	// If busy, wait
+// Put the transaction at the tail of the queue on the bus
+static void I2C_Begin(void) {
+	I2C_Transaction *t = &i2cQueue[i2cTail & (I2C_QUEUE_SIZE - 1)];
+	DMA_Channel_TypeDef *dma = (t->direction == READ_FROM_SLAVE) ? DMA1_Channel7 : DMA1_Channel6;
+	uint32_t tmpreg;
+	uint16_t block = t->size > 255 ? 255 : t->size;
+	
+	i2cActive = 1;
+	i2cStatus = I2C_OK;
+	i2cRemaining = t->size - block;
+	// 9 bit times per byte plus the address, doubled for clock stretching and a slower SCL
+	i2cTimeout = I2C_TIMEOUT_MS + 2U * (t->size + 1U) * 9000U / i2cSpeed;
+	i2cStart = SysTick_GetTick();
+	
+	dma->CCR &= ~DMA_CCR_EN;
+	dma->CMAR = (uint32_t) t->buffer;
+	dma->CNDTR = t->size;
+	dma->CCR |= DMA_CCR_EN;
+	
+	tmpreg = I2C1->CR2 & ~(I2C_CR2_SADD | I2C_CR2_NBYTES | I2C_CR2_RELOAD | I2C_CR2_AUTOEND | I2C_CR2_RD_WRN | I2C_CR2_START | I2C_CR2_STOP);
+	tmpreg |= ((uint32_t)t->address & I2C_CR2_SADD) | ((uint32_t)block << 16);
+	tmpreg |= (i2cRemaining != 0) ? I2C_CR2_RELOAD : I2C_CR2_AUTOEND; // STOP follows the last byte
+	if (t->direction == READ_FROM_SLAVE) tmpreg |= I2C_CR2_RD_WRN;
+	I2C1->CR2 = tmpreg | I2C_CR2_START;
 }
 
-//===============================================================================
-//                           I2C Send Data
-//=============================================================================== 
-int8_t I2C_SendData(I2C_TypeDef * I2Cx, uint8_t DeviceAddress, uint8_t *pData, uint8_t Size) {
-	int i;
+// Finish the active transaction and start the next one
+static void I2C_Complete(void) {
+	I2C_Transaction *t = &i2cQueue[i2cTail & (I2C_QUEUE_SIZE - 1)];
 	
-	if (Size <= 0 || pData == NULL) return -1;
+	DMA1_Channel6->CCR &= ~DMA_CCR_EN;
+	DMA1_Channel7->CCR &= ~DMA_CCR_EN;
+	I2C1->ISR |= I2C_ISR_TXE; // flush a byte the DMA left behind after a NACK
 	
-	I2C_WaitLineIdle(I2Cx);
+	i2cActive = 0;
+	i2cStats.transactions++;
+	i2cTail++;
+	if (t->callback != NULL) t->callback(i2cStatus, t->context);
+	if (i2cTail != i2cHead) I2C_Begin();
+}
+
+// Queue a transaction, returns -1 if the queue is full
+int8_t I2C_Submit(const I2C_Transaction *t) {
+	uint32_t primask;
 	
-	if (I2C_Start(I2Cx, DeviceAddress, Size, WRITE_TO_SLAVE) < 0 ) return -1;
+	if (t->size == 0 || t->buffer == NULL) return -1;
+	primask = __get_PRIMASK();
+	__disable_irq();
+	if ((uint8_t)(i2cHead - i2cTail) >= I2C_QUEUE_SIZE) {
+		__set_PRIMASK(primask);
+		return -1;
+	}
+	i2cQueue[i2cHead & (I2C_QUEUE_SIZE - 1)] = *t;
+	i2cHead++;
+	if (!i2cActive) I2C_Begin();
+	__set_PRIMASK(primask);
+	return 0;
+}
 
-	// Send Data
-	// Write the first data in DR register
-	// while((I2Cx->ISR & I2C_ISR_TXE) == 0);
-	// I2Cx->TXDR = pData[0] & I2C_TXDR_TXDATA;  
+// Nonzero while transactions are queued or on the bus
+uint8_t I2C_Busy(void) {
+	return i2cHead != i2cTail;
+}
 
-	for (i = 0; i < Size; i++) {
-		// TXE is set by hardware when the I2C_TXDR register is empty. It is cleared when the next
-		// data to be sent is written in the I2C_TXDR register.
-		// while( (I2Cx->ISR & I2C_ISR_TXE) == 0 ); 
+static uint8_t I2C_HasRoom(void) {
+	return (uint8_t)(i2cHead - i2cTail) < I2C_QUEUE_SIZE;
+}
 
-		// TXIS bit is set by hardware when the I2C_TXDR register is empty and the data to be
-		// transmitted must be written in the I2C_TXDR register. It is cleared when the next data to be
-		// sent is written in the I2C_TXDR register.
-		// The TXIS flag is not set when a NACK is received.
-		while((I2Cx->ISR & I2C_ISR_TXIS) == 0 );
-		I2Cx->TXDR = pData[i] & I2C_TXDR_TXDATA;  // TXE is cleared by writing to the TXDR register.
+// Transaction watchdog, called from the main loop and from every wait on the
+// queue. A transaction that overruns its time is abandoned with
+// I2C_ERR_TIMEOUT after a bus recovery, so no I2C wait can last longer than
+// I2C_QUEUE_SIZE transactions' worth of timeouts.
+void I2C_Poll(void) {
+	if (!i2cActive || SysTick_GetTick() - i2cStart <= i2cTimeout) return;
+	
+	NVIC_DisableIRQ(I2C1_EV_IRQn);
+	NVIC_DisableIRQ(I2C1_ER_IRQn);
+	if (i2cActive && SysTick_GetTick() - i2cStart > i2cTimeout) { // the ISR may have finished it meanwhile
+		i2cStats.timeouts++;
+		I2C_RecoverBus();
+		i2cStatus = I2C_ERR_TIMEOUT;
+		I2C_Complete();
 	}
+	NVIC_EnableIRQ(I2C1_EV_IRQn);
+	NVIC_EnableIRQ(I2C1_ER_IRQn);
+}
+
+void I2C_GetStats(I2C_Stats *stats) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	*stats = i2cStats;
+	__set_PRIMASK(primask);
+}
+
+void I2C1_EV_IRQHandler(void) {
+	uint32_t isr = I2C1->ISR;
+	uint32_t tmpreg;
 	
-	// Wait until TC flag is set 
-	while((I2Cx->ISR & I2C_ISR_TC) == 0 && (I2Cx->ISR & I2C_ISR_NACKF) == 0);
+	if (isr & I2C_ISR_NACKF) {
+		// slave refused a byte, hardware sends STOP and STOPF completes the transaction
+		I2C1->ICR = I2C_ICR_NACKCF;
+		i2cStats.nacks++;
+		i2cStatus = I2C_ERR_NACK;
+	}
+	if (isr & I2C_ISR_TCR) {
+		// 255 byte block done in reload mode, load the next block
+		tmpreg = I2C1->CR2 & ~(I2C_CR2_NBYTES | I2C_CR2_RELOAD);
+		if (i2cRemaining > 255) {
+			tmpreg |= (255U << 16) | I2C_CR2_RELOAD;
+			i2cRemaining -= 255;
+		} else {
+			tmpreg |= ((uint32_t)i2cRemaining << 16) | I2C_CR2_AUTOEND;
+			i2cRemaining = 0;
+		}
+		I2C1->CR2 = tmpreg;
+	}
+	if (isr & I2C_ISR_STOPF) {
+		I2C1->ICR = I2C_ICR_STOPCF;
+		if (i2cActive) I2C_Complete();
+	}
+}
+
+void I2C1_ER_IRQHandler(void) {
+	uint32_t isr = I2C1->ISR;
 	
-	if( (I2Cx->ISR & I2C_ISR_NACKF) != 0 ) return -1;
+	// bus error, arbitration loss or overrun: no STOP will follow, end the transaction here
+	if (isr & I2C_ISR_OVR) {
+		i2cStats.overruns++;
+		i2cStatus = I2C_ERR_BUS;
+	}
+	if (isr & I2C_ISR_BERR) {
+		i2cStats.busErrors++;
+		i2cStatus = I2C_ERR_BUS;
+	}
+	if (isr & I2C_ISR_ARLO) {
+		i2cStats.arbitrationLost++;
+		i2cStatus = I2C_ERR_ARLO;
+	}
+	I2C1->ICR = I2C_ICR_BERRCF | I2C_ICR_ARLOCF | I2C_ICR_OVRCF;
+	if (i2cActive) I2C_Complete();
+}
 
-	I2C_Stop(I2Cx);
-	return 0;
+//===============================================================================
+//                      Blocking wrappers
+//===============================================================================
+static volatile uint8_t i2cDone;
+static volatile int8_t i2cResult;
+
+static void I2C_BlockingDone(int8_t status, void *context) {
+	i2cResult = status;
+	i2cDone = 1;
 }
 
+static int8_t I2C_Transfer(I2C_TypeDef * I2Cx, uint8_t DeviceAddress, uint8_t *pData, uint16_t Size, uint8_t Direction) {
+	I2C_Transaction t;
+	
+	if (I2Cx != I2C1 || Size == 0 || pData == NULL) return I2C_ERR_BUS;
+	t.address = DeviceAddress;
+	t.direction = Direction;
+	t.buffer = pData;
+	t.size = Size;
+	t.callback = I2C_BlockingDone;
+	t.context = NULL;
+	
+	i2cDone = 0;
+	while (I2C_Submit(&t) != 0) I2C_WAIT(I2C_HasRoom()); // queue full, wait for room
+	while (!i2cDone) I2C_WAIT(i2cDone);
+	return i2cResult;
+}
+
+//===============================================================================
+//                           I2C Send Data
+//=============================================================================== 
+int8_t I2C_SendData(I2C_TypeDef * I2Cx, uint8_t DeviceAddress, uint8_t *pData, uint16_t Size) {
+	return I2C_Transfer(I2Cx, DeviceAddress, pData, Size, WRITE_TO_SLAVE);
+}
 
 //===============================================================================
 //                           I2C Receive Data
 //=============================================================================== 
 int8_t I2C_ReceiveData(I2C_TypeDef * I2Cx, uint8_t DeviceAddress, uint8_t *pData, uint8_t Size) {
-	int i;
-	
-	if(Size <= 0 || pData == NULL) return -1;
+	return I2C_Transfer(I2Cx, DeviceAddress, pData, Size, READ_FROM_SLAVE);
+}
 
-	I2C_WaitLineIdle(I2Cx);
+// PCF8574 to HD44780 wiring: P0 = RS, P1 = R/W, P2 = EN, P3 = backlight, P4-P7 = D4-D7
+#define LCD_RS        0x01U
+#define LCD_RW        0x02U
+#define LCD_EN        0x04U
+#define LCD_BACKLIGHT 0x08U
+#define LCD_BUSY      0x80U // busy flag, D7 of the status read
 
-	I2C_Start(I2Cx, DeviceAddress, Size, READ_FROM_SLAVE); // 0 = sending data to the slave, 1 = receiving data from the slave
-						  	
-	for (i = 0; i < Size; i++) {
-		// Wait until RXNE flag is set 	
-		while( (I2Cx->ISR & I2C_ISR_RXNE) == 0 );
-		pData[i] = I2Cx->RXDR & I2C_RXDR_RXDATA;
-	}
-	
-	// Wait until TCR flag is set 
-	while((I2Cx->ISR & I2C_ISR_TC) == 0);
-	
-	I2C_Stop(I2Cx);
-	
-	return 0;
-}
+static uint8_t lcdBusyFlag; // R/W is wired and the busy flag reads back correctly
+static uint8_t lcdBacklight = LCD_BACKLIGHT; // P3 level sent with every write
 
-void LCD_Send_CMD(char cmd) {
+// Nibble strobes waiting to go out in one I2C transaction. Two buffers:
+// one is filled while the other is still being sent by DMA.
+static uint8_t lcdBatch[2][4 * LCD_BATCH_MAX];
+static volatile uint8_t lcdBatchBusy[2];
+static uint8_t lcdBatchIndex;
+static uint16_t lcdBatchLen;
+
+// Expand a byte into the four PCF8574 writes that clock it into the HD44780
+static void LCD_Expand(uint8_t *out, char value, uint8_t rs) {
 	// 4 bit data represention, 4 LSB are dropped
 	// to send a byte, send two 4-bit nibbles (where the 4-bits are in the left half)
-	char data_u, data_l;
-	uint8_t data_t[4];
-	data_u = (cmd&0xf0);
-	data_l = ((cmd<<4)&0xf0);
-	data_t[0] = data_u|0x0C;  //en=1, rs=0
-	data_t[1] = data_u|0x08;  //en=0, rs=0
-	data_t[2] = data_l|0x0C;  //en=1, rs=0
-	data_t[3] = data_l|0x08;  //en=0, rs=0
-	I2C_SendData(LCD_I2C, SLAVE_ADDRESS_LCD, data_t, 4);
+	uint8_t data_u = (value&0xf0);
+	uint8_t data_l = ((value<<4)&0xf0);
+	out[0] = data_u|lcdBacklight|LCD_EN|rs;  //en=1
+	out[1] = data_u|lcdBacklight|rs;         //en=0
+	out[2] = data_l|lcdBacklight|LCD_EN|rs;  //en=1
+	out[3] = data_l|lcdBacklight|rs;         //en=0
 }
 
-void LCD_Send_Data(char data) {
-	char data_u, data_l;
+void LCD_Send_CMD(char cmd) {
 	uint8_t data_t[4];
-	data_u = (data&0xf0);
-	data_l = ((data<<4)&0xf0);
-	data_t[0] = data_u|0x0D;  //en=1, rs=1
-	data_t[1] = data_u|0x09;  //en=0, rs=1
-	data_t[2] = data_l|0x0D;  //en=1, rs=1
-	data_t[3] = data_l|0x09;  //en=0, rs=1
+	LCD_Expand(data_t, cmd, 0);
 	I2C_SendData(LCD_I2C, SLAVE_ADDRESS_LCD, data_t, 4);
 }
+
+static void LCD_Batch_Done(int8_t status, void *context) {
+	*(volatile uint8_t *)context = 0;
+}
+
+// Batched writes: commands and characters are queued and sent as a single
+// I2C transaction by LCD_Batch_Send (or when the batch buffer fills).
+// The transfer runs in the background, LCD_Batch_Send returns immediately.
+// Only for commands that complete in 37us: a command takes 4 bus bytes,
+// ~90us at 400 kHz, which leaves the HD44780 enough time. At fast mode plus
+// the same 4 bytes take ~36us, so the LCD bus is capped at fast mode.
+// Clear and home must go through LCD_Clear to wait on the busy flag.
+void LCD_Batch_Send(void) {
+	I2C_Transaction t;
+	
+	if (lcdBatchLen == 0) return;
+	t.address = SLAVE_ADDRESS_LCD;
+	t.direction = WRITE_TO_SLAVE;
+	t.buffer = lcdBatch[lcdBatchIndex];
+	t.size = lcdBatchLen;
+	t.callback = LCD_Batch_Done;
+	t.context = (void *) &lcdBatchBusy[lcdBatchIndex];
+	
+	lcdBatchBusy[lcdBatchIndex] = 1;
+	while (I2C_Submit(&t) != 0) I2C_WAIT(I2C_HasRoom()); // queue full, wait for room
+	lcdBatchIndex ^= 1;
+	lcdBatchLen = 0;
+}
+
+static void LCD_Batch_Add(char value, uint8_t rs) {
+	if (lcdBatchLen == sizeof(lcdBatch[0])) LCD_Batch_Send();
+	while (lcdBatchBusy[lcdBatchIndex]) I2C_WAIT(!lcdBatchBusy[lcdBatchIndex]); // buffer still owned by the DMA
+	LCD_Expand(&lcdBatch[lcdBatchIndex][lcdBatchLen], value, rs);
+	lcdBatchLen += 4;
+}
+
+// Nonzero when the next LCD_Batch_CMD, LCD_Batch_Data or LCD_Batch_Send
+// returns without waiting, for callers that yield instead
+uint8_t LCD_Batch_Ready(void) {
+	uint8_t next = lcdBatchLen == sizeof(lcdBatch[0]) ? lcdBatchIndex ^ 1 : lcdBatchIndex;
+	return I2C_HasRoom() && !lcdBatchBusy[next];
+}
+
+void LCD_Batch_CMD(char cmd) {
+	LCD_Batch_Add(cmd, 0);
+}
+
+void LCD_Batch_Data(char data) {
+	LCD_Batch_Add(data, LCD_RS);
+}
+
+// Read the HD44780 status (busy flag and address counter high bits).
+// D4-D7 are written high so the PCF8574 releases them to the LCD, then the
+// high nibble is sampled while EN is high; the low nibble is clocked out
+// and dropped.
+static int8_t LCD_ReadStatus(uint8_t *status) {
+	uint8_t strobe[3];
+	int8_t result;
+	
+	strobe[0] = 0xF0U|lcdBacklight|LCD_RW;
+	strobe[1] = 0xF0U|lcdBacklight|LCD_RW|LCD_EN;
+	result = I2C_SendData(LCD_I2C, SLAVE_ADDRESS_LCD, strobe, 2);
+	if (result == I2C_OK) result = I2C_ReceiveData(LCD_I2C, SLAVE_ADDRESS_LCD, status, 1);
+	strobe[0] = 0xF0U|lcdBacklight|LCD_RW;
+	strobe[1] = 0xF0U|lcdBacklight|LCD_RW|LCD_EN;
+	strobe[2] = 0xF0U|lcdBacklight|LCD_RW;
+	I2C_SendData(LCD_I2C, SLAVE_ADDRESS_LCD, strobe, 3);
+	return result;
+}
+
+// Wait until the LCD accepts the next command. Polls the busy flag when it
+// is available, otherwise (or if a read fails) waits the fixed time.
+static void LCD_WaitReady(uint32_t fallback) {
+	uint8_t status;
+	uint32_t start = SysTick_GetTick();
+	
+	if (lcdBusyFlag) {
+		while (LCD_ReadStatus(&status) == I2C_OK) {
+			if ((status & LCD_BUSY) == 0) return;
+			if (SysTick_GetTick() - start > fallback) return; // as long as the fixed delay
+		}
+	}
+	delay(fallback);
+}
+
 void LCD_Init(void) {
+	uint8_t status;
+	
 	  //Initialization of HD44780-based LCD (4-bit HW)
 	LCD_Send_CMD(0x33);
 	LCD_Send_CMD(0x32);
@@ -243,52 +528,37 @@ void LCD_Init(void) {
 	LCD_Send_CMD(0x0C);   //Display On/Off Control
 	LCD_Send_CMD(0x06);   //Entry mode set
 	LCD_Send_CMD(0x02);   //Clear Display
-	//Minimum delay to wait before driving LCD module
-	delay(200);
+	delay(2);
+	
+	// An idle LCD reads back busy = 0. Backpacks with R/W tied low return the
+	// 1 we wrote to D7, and then only the fixed delays can be used.
+	lcdBusyFlag = LCD_ReadStatus(&status) == I2C_OK && (status & LCD_BUSY) == 0;
+	if (!lcdBusyFlag) {
+		//Minimum delay to wait before driving LCD module
+		delay(200);
+	}
 }
 
+// The backlight is P3 of the PCF8574, not an HD44780 command. The new level
+// is written on its own and carried by every following nibble strobe.
 void LCD_BL(bool val) {
-	if (val) {
-		LCD_Send_CMD(0x0C); // set backlight on (turn on LCD)
-	} else {
-		LCD_Send_CMD(0x08); // set backlight off (turn off LCD)
-	}
+	uint8_t data_t[1];
+	LCD_Batch_Send(); // pending strobes still carry the old level
+	lcdBacklight = val ? LCD_BACKLIGHT : 0;
+	data_t[0] = lcdBacklight;
+	I2C_SendData(LCD_I2C, SLAVE_ADDRESS_LCD, data_t, 1);
 }
 
 void LCD_Clear(void) { // clear display and move cursor to home (1, 1)
 	LCD_Send_CMD(0x01);
-	delay(2);
-}
-
-void LCD_Home(void) { // move cursor to home position (1, 1)
-	LCD_Send_CMD(0x02);
-	delay(2);
-}
-
-void LCD_Locate(uint8_t row, uint8_t column) {
-	column--; // 1-index to 0-index
-	switch(row) {
-		case 1:
-			LCD_Send_CMD(column | 0x80);
-			break;
-		case 2:
-			LCD_Send_CMD(column | 0xC0);
-			break;
-		case 3:
-			LCD_Send_CMD(column | 0x94);
-			break;
-		case 4:
-			LCD_Send_CMD(column | 0xD4);
-			break;
-		default:
-			break;
-	}
-}
-
-void LCD_printchar(char c) {
-	LCD_Send_Data(c);
+	LCD_WaitReady(2);
 }
 
-void LCD_print_str(char* str) {
-	while (*str) LCD_Send_Data(*str++);
+// Upload a 5x8 glyph to CGRAM location 0-7, top row first. Leaves the
+// address counter in CGRAM: set a DDRAM address before printing again.
+void LCD_CreateChar(uint8_t location, const uint8_t *pattern) {
+	uint8_t row;
+	LCD_Batch_CMD(0x40 | ((location & 0x07) << 3)); // set CGRAM address
+	for (row = 0; row < 8; row++) LCD_Batch_Data(pattern[row] & 0x1F);
+	LCD_Batch_Send();
 }
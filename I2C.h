@@ -9,23 +9,143 @@
 #define READ_FROM_SLAVE 1
 #define WRITE_TO_SLAVE  0
 
-int8_t I2C_Start(I2C_TypeDef * I2Cx, uint32_t DevAddress, uint8_t Size, uint8_t Direction);
-void I2C_Stop(I2C_TypeDef * I2Cx);
-void I2C_WaitLineIdle(I2C_TypeDef * I2Cx);
-int8_t I2C_SendData(I2C_TypeDef * I2Cx, uint8_t DeviceAddress, uint8_t *pData, uint8_t Size);
+#define LCD_BATCH_MAX   128 // bytes (characters or commands) per batched LCD transaction
+#define I2C_QUEUE_SIZE  8   // pending asynchronous transactions, power of 2
+#define I2C_TIMEOUT_MS  5U  // allowance per transaction on top of twice its nominal byte time
+#define I2C_RECOVERY_CLOCKS 9U // SCL pulses that free a slave stuck in the middle of a byte
+
+// Transaction status
+#define I2C_OK          0
+#define I2C_ERR_NACK    (-1) // address or data byte not acknowledged
+#define I2C_ERR_BUS     (-2) // misplaced START/STOP or overrun
+#define I2C_ERR_ARLO    (-3) // arbitration lost
+#define I2C_ERR_TIMEOUT (-4) // no completion in time, the bus was recovered
+
+#define I2C_TIMINGR_PRESC_POS	28
+#define I2C_TIMINGR_SCLDEL_POS	20
+#define I2C_TIMINGR_SDADEL_POS	16
+#define I2C_TIMINGR_SCLH_POS	8
+#define I2C_TIMINGR_SCLL_POS	0
+
+//===============================================================================
+//                           I2C Timing Calculator
+// TIMINGR for kernel clock clk (Hz), bus speed bus (Hz) and SCL/SDA rise
+// and fall times tr/tf (ns), following the reference manual constraints
+// with the analog filter on and the digital filter off. Every macro is a
+// constant expression when its arguments are, so fixed clocks are resolved
+// at compile time; I2C_ComputeTiming evaluates the same macros at runtime.
+// The result never exceeds the requested speed; if the kernel clock is too
+// slow for it, the fastest timing that meets tLOW/tHIGH is used instead.
+//===============================================================================
+#define I2C_SPEED_STANDARD  100000U
+#define I2C_SPEED_FAST      400000U
+#define I2C_SPEED_FASTPLUS  1000000U
+
+// I2C specification minimums and the analog filter delay, in ns
+#define I2C_TLOW_MIN(bus)   ((bus) <= I2C_SPEED_STANDARD ? 4700U : (bus) <= I2C_SPEED_FAST ? 1300U : 500U)
+#define I2C_THIGH_MIN(bus)  ((bus) <= I2C_SPEED_STANDARD ? 4000U : (bus) <= I2C_SPEED_FAST ? 600U : 260U)
+#define I2C_TSUDAT_MIN(bus) ((bus) <= I2C_SPEED_STANDARD ? 250U : (bus) <= I2C_SPEED_FAST ? 100U : 50U)
+#define I2C_TAF_MIN         50U
+
+#define I2C_MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define I2C_MAX(a, b)       ((a) > (b) ? (a) : (b))
+#define I2C_DIV_CEIL(a, b)  (((a) + (b) - 1U) / (b))
+#define I2C_CYCLES(ns, clk) ((uint32_t) I2C_DIV_CEIL((uint64_t)(ns) * (clk), 1000000000ULL))
+
+// SCL period in kernel clocks, minus the synchronization delays (edges plus ~2 clocks each)
+#define I2C_SYNC(clk, tr, tf)        ((uint32_t)((uint64_t)((tr) + (tf)) * (clk) / 1000000000ULL) + 4U)
+#define I2C_AVAIL(clk, bus, tr, tf)  (I2C_DIV_CEIL((clk), (bus)) > I2C_SYNC(clk, tr, tf) + 2U ? \
+                                      I2C_DIV_CEIL((clk), (bus)) - I2C_SYNC(clk, tr, tf) : 2U)
+
+// SCLL + SCLH can count 512 prescaled clocks at most, SCLDEL 16 and SDADEL 15
+#define I2C_PRESC(clk, bus, tr, tf)  I2C_MIN(I2C_MAX(I2C_DIV_CEIL(I2C_AVAIL(clk, bus, tr, tf), 512U), \
+	I2C_MAX(I2C_DIV_CEIL(I2C_CYCLES((tr) + I2C_TSUDAT_MIN(bus), clk), 16U), \
+	        I2C_DIV_CEIL(I2C_CYCLES((tf) > I2C_TAF_MIN ? (tf) - I2C_TAF_MIN : 0U, clk), 15U))) - 1U, 15U)
+#define I2C_TICK(clk, bus, tr, tf)   (I2C_PRESC(clk, bus, tr, tf) + 1U)
+#define I2C_TICKS(clk, bus, tr, tf)  I2C_DIV_CEIL(I2C_AVAIL(clk, bus, tr, tf), I2C_TICK(clk, bus, tr, tf))
+
+// Split the period between low and high in the ratio of their minimums
+#define I2C_LOW_TICKS(clk, bus, tr, tf) \
+	I2C_MAX(I2C_DIV_CEIL(I2C_CYCLES(I2C_TLOW_MIN(bus), clk), I2C_TICK(clk, bus, tr, tf)), \
+	        I2C_TICKS(clk, bus, tr, tf) * I2C_TLOW_MIN(bus) / (I2C_TLOW_MIN(bus) + I2C_THIGH_MIN(bus)))
+#define I2C_HIGH_TICKS(clk, bus, tr, tf) \
+	I2C_MAX(I2C_DIV_CEIL(I2C_CYCLES(I2C_THIGH_MIN(bus), clk), I2C_TICK(clk, bus, tr, tf)), \
+	        I2C_TICKS(clk, bus, tr, tf) > I2C_LOW_TICKS(clk, bus, tr, tf) ? \
+	        I2C_TICKS(clk, bus, tr, tf) - I2C_LOW_TICKS(clk, bus, tr, tf) : 0U)
+
+#define I2C_SCLL(clk, bus, tr, tf)   (I2C_MIN(I2C_LOW_TICKS(clk, bus, tr, tf), 256U) - 1U)
+#define I2C_SCLH(clk, bus, tr, tf)   (I2C_MIN(I2C_HIGH_TICKS(clk, bus, tr, tf), 256U) - 1U)
+
+// Data hold must cover the fall time, data setup the rise time plus tSU;DAT
+#define I2C_SDADEL(clk, bus, tr, tf) I2C_MIN((tf) > I2C_TAF_MIN ? \
+	I2C_DIV_CEIL(I2C_CYCLES((tf) - I2C_TAF_MIN, clk), I2C_TICK(clk, bus, tr, tf)) : 0U, 15U)
+#define I2C_SCLDEL(clk, bus, tr, tf) I2C_MIN(I2C_DIV_CEIL(I2C_CYCLES((tr) + I2C_TSUDAT_MIN(bus), clk), \
+	I2C_TICK(clk, bus, tr, tf)) - 1U, 15U)
+
+#define I2C_TIMING(clk, bus, tr, tf) \
+	((I2C_PRESC(clk, bus, tr, tf)  << I2C_TIMINGR_PRESC_POS)  | \
+	 (I2C_SCLDEL(clk, bus, tr, tf) << I2C_TIMINGR_SCLDEL_POS) | \
+	 (I2C_SDADEL(clk, bus, tr, tf) << I2C_TIMINGR_SDADEL_POS) | \
+	 (I2C_SCLH(clk, bus, tr, tf)   << I2C_TIMINGR_SCLH_POS)   | \
+	 (I2C_SCLL(clk, bus, tr, tf)   << I2C_TIMINGR_SCLL_POS))
+
+// SCL period the timing gives, in kernel clocks, and whether it meets the
+// specification: low and high counters not clamped, bus no faster than asked
+#define I2C_PERIOD(clk, bus, tr, tf) \
+	((I2C_SCLL(clk, bus, tr, tf) + I2C_SCLH(clk, bus, tr, tf) + 2U) * I2C_TICK(clk, bus, tr, tf) + \
+	 I2C_SYNC(clk, tr, tf))
+#define I2C_TIMING_OK(clk, bus, tr, tf) \
+	(I2C_LOW_TICKS(clk, bus, tr, tf) <= 256U && I2C_HIGH_TICKS(clk, bus, tr, tf) <= 256U && \
+	 I2C_PERIOD(clk, bus, tr, tf) >= I2C_DIV_CEIL((clk), (bus)))
+
+// LCD bus: PCF8574 backpack with 4.7k pull-ups
+#define I2C_LCD_SPEED   I2C_SPEED_FAST
+#define I2C_RISE_NS     300U
+#define I2C_FALL_NS     100U
+
+// status is I2C_OK or one of I2C_ERR_*; called from interrupt context
+typedef void (*I2C_Callback)(int8_t status, void *context);
+
+typedef struct {
+	uint8_t address;    // 8-bit slave address (7-bit address << 1)
+	uint8_t direction;  // READ_FROM_SLAVE or WRITE_TO_SLAVE
+	uint8_t *buffer;    // must stay valid until the callback
+	uint16_t size;
+	I2C_Callback callback;
+	void *context;
+} I2C_Transaction;
+
+typedef struct {
+	uint32_t transactions;  // completed, successfully or not
+	uint32_t nacks;
+	uint32_t busErrors;
+	uint32_t arbitrationLost;
+	uint32_t overruns;
+	uint32_t timeouts;
+	uint32_t recoveries;
+} I2C_Stats;
+
+int8_t I2C_SendData(I2C_TypeDef * I2Cx, uint8_t DeviceAddress, uint8_t *pData, uint16_t Size);
 int8_t I2C_ReceiveData(I2C_TypeDef * I2Cx, uint8_t DeviceAddress, uint8_t *pData, uint8_t Size);
 void I2C_GPIO_Init(void);
 void I2C_Initialization(void);
+void I2C_DMA_Init(void);
+uint32_t I2C_ComputeTiming(uint32_t clk, uint32_t bus, uint32_t tr, uint32_t tf);
+int8_t I2C_Submit(const I2C_Transaction *t);
+uint8_t I2C_Busy(void);
+void I2C_Poll(void);
+void I2C_RecoverBus(void);
+void I2C_GetStats(I2C_Stats *stats);
 void CODEC_Initialization(void);
 
 void LCD_Init(void);
-void LCD_Send_Data(char);
 void LCD_Send_CMD(char);
+void LCD_Batch_CMD(char);
+void LCD_Batch_Data(char);
+void LCD_Batch_Send(void);
+uint8_t LCD_Batch_Ready(void);
 void LCD_BL(bool);
 void LCD_Clear(void);
-void LCD_Home(void);
-void LCD_Locate(uint8_t, uint8_t);
-void LCD_printchar(char);
-void LCD_print_str(char*);
+void LCD_CreateChar(uint8_t, const uint8_t*);
 
 #endif
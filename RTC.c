@@ -11,12 +11,6 @@
 
 // Use the 32.768 kHz low-speed external clock as RTC clock source
 
-// Helper macro to convert a value from 2 digit decimal format to BCD format
-// __VALUE__ Byte to be converted
-
-#define __RTC_CONVERT_BIN2BCD(__VALUE__)   (uint8_t)((((__VALUE__) / 10) << 4) | ((__VALUE__) % 10))
-#define __RTC_CONVERT_BCD2BIN(__VALUE__) (uint8_t)(((uint8_t)((__VALUE__) & (uint8_t)0xF0) >> (uint8_t)0x4) * 10 + ((__VALUE__) & (uint8_t)0x0F))
-
 #define RTC_WEEKDAY_MONDAY              ((uint32_t)0x01) /*!< Monday    */
 #define RTC_WEEKDAY_TUESDAY             ((uint32_t)0x02) /*!< Tuesday   */
 #define RTC_WEEKDAY_WEDNESDAY           ((uint32_t)0x03) /*!< Wednesday */
@@ -48,6 +42,17 @@ void RTC_BAK_SetRegister(uint32_t BackupRegister, uint32_t Data) {
 	*(__IO uint32_t *)tmp = (uint32_t)Data;
 }
 
+uint32_t RTC_BAK_GetRegister(uint32_t BackupRegister) {
+	return (&(RTC->BKP0R))[BackupRegister];
+}
+
+static uint8_t warmBoot;
+
+// Nonzero if RTC_Init found the calendar running and left it alone
+uint8_t RTC_WarmBoot(void) {
+	return warmBoot;
+}
+
 void RTC_Init(void) {
 	
 	/* Enables the PWR Clock and Enables access to the backup domain #######*/
@@ -58,6 +63,17 @@ void RTC_Init(void) {
 	 - Configure the needed RTC clock source */
 	RTC_Clock_Init();
 	
+	// Warm boot: the calendar kept running through the reset, only wait for
+	// the shadow registers to resynchronize before they are read
+	if (RTC_BAK_GetRegister(RTC_BKP_STAMP_REG) == RTC_BKP_STAMP && (RTC->ISR & RTC_ISR_INITS) == RTC_ISR_INITS) {
+		warmBoot = 1;
+		RTC_Disable_Write_Protection();
+		RTC->ISR &= ~RTC_ISR_RSF;
+		RTC_Enable_Write_Protection();
+		while((RTC->ISR & RTC_ISR_RSF) == 0);
+		return;
+	}
+	
 	// Disable RTC registers write protection
 	RTC_Disable_Write_Protection();
 	
@@ -84,7 +100,7 @@ void RTC_Init(void) {
 
 	// Writes a data in a RTC Backup data Register1 
 	// to indicate date/time updated 
-	RTC_BAK_SetRegister(1, 0x32F2);
+	RTC_BAK_SetRegister(RTC_BKP_STAMP_REG, RTC_BKP_STAMP);
 }
 
 #define POSITION_VAL(VAL)     (__CLZ(__RBIT(VAL)))
@@ -102,10 +118,11 @@ void RTC_Init(void) {
 #define RTC_POSITION_DR_DU    (uint32_t)POSITION_VAL(RTC_DR_DU)
 #define RTC_POSITION_DR_WDU   (uint32_t)POSITION_VAL(RTC_DR_WDU)
 
+// Values in BCD, only valid in initialization mode
 void RTC_Set_Calendar_Date(uint32_t WeekDay, uint32_t Day, uint32_t Month, uint32_t Year) {
 	//Day -= 1;
 	// Day is 0x23
-	RTC->DR |= ((RTC_DR_YT & (Year >> 4 << RTC_POSITION_DR_YT))
+	RTC->DR = ((RTC_DR_YT & (Year >> 4 << RTC_POSITION_DR_YT))
 			|   (RTC_DR_YU & (Year << RTC_POSITION_DR_YU))
 			|   (RTC_DR_MT & (Month >> 4 << RTC_POSITION_DR_MT))
 			|   (RTC_DR_MU & (Month << RTC_POSITION_DR_MU))
@@ -115,7 +132,7 @@ void RTC_Set_Calendar_Date(uint32_t WeekDay, uint32_t Day, uint32_t Month, uint3
 }
 
 void RTC_Set_Time(uint32_t Format12_24, uint32_t Hour, uint32_t Minute, uint32_t Second) {
-	RTC->TR |= ((RTC_TR_HT & (Hour >> 4 << RTC_POSITION_TR_HT))
+	RTC->TR = ((RTC_TR_HT & (Hour >> 4 << RTC_POSITION_TR_HT))
 			|   (RTC_TR_HU & (Hour << RTC_POSITION_TR_HU))
 			|   (RTC_TR_MNT & (Minute >> 4 << RTC_POSITION_TR_MT))
 			|   (RTC_TR_MNU & (Minute << RTC_POSITION_TR_MU))
@@ -123,6 +140,82 @@ void RTC_Set_Time(uint32_t Format12_24, uint32_t Hour, uint32_t Minute, uint32_t
 			|   (RTC_TR_SU & (Second << RTC_POSITION_TR_SU)));
 }
 
+static void RTC_Enter_Init(void) {
+	RTC_Disable_Write_Protection();
+	RTC->ISR |= RTC_ISR_INIT;
+	while( (RTC->ISR & RTC_ISR_INITF) == 0);
+}
+
+static void RTC_Exit_Init(void) {
+	RTC->ISR &= ~RTC_ISR_INIT;
+	while((RTC->ISR & RTC_ISR_RSF) == 0); /* Wait for synchro */
+	RTC_Enable_Write_Protection();
+	RTC_BAK_SetRegister(RTC_BKP_STAMP_REG, RTC_BKP_STAMP);
+}
+
+// Day of the week, 1 = Monday ... 7 = Sunday as in RTC_DR
+static uint32_t RTC_Weekday(uint32_t Year, uint32_t Month, uint32_t Day) {
+	static const uint8_t offset[] = {0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4};
+	uint32_t w;
+	if (Month < 3) Year--;
+	w = (Year + Year / 4 - Year / 100 + Year / 400 + offset[Month - 1] + Day) % 7; // 0 = Sunday
+	return w == 0 ? RTC_WEEKDAY_SUNDAY : w;
+}
+
+// Set the date from binary values, Year 2000-2099
+void RTC_Set_Date(uint32_t Year, uint32_t Month, uint32_t Day) {
+	uint32_t tr = RTC->TR;
+	(void) RTC->DR;
+	RTC_Enter_Init();
+	RTC_Set_Calendar_Date(RTC_Weekday(Year, Month, Day), __RTC_CONVERT_BIN2BCD(Day),
+	                      __RTC_CONVERT_BIN2BCD(Month), __RTC_CONVERT_BIN2BCD(Year % 100));
+	RTC->TR = tr; // init mode restarts the calendar, keep the time
+	RTC_Exit_Init();
+}
+
+// Set the time of day from binary values, 24 hour format
+void RTC_Set_Clock(uint32_t Hour, uint32_t Minute, uint32_t Second) {
+	uint32_t dr;
+	(void) RTC->TR;
+	dr = RTC->DR;
+	RTC_Enter_Init();
+	RTC_Set_Time(0, __RTC_CONVERT_BIN2BCD(Hour), __RTC_CONVERT_BIN2BCD(Minute), __RTC_CONVERT_BIN2BCD(Second));
+	RTC->DR = dr;
+	RTC_Exit_Init();
+}
+
+void RTC_Get_Clock(uint8_t* Hour, uint8_t* Minute, uint8_t* Second) {
+	uint32_t tr = RTC->TR;
+	(void) RTC->DR; // unlock the shadow registers
+	*Hour = __RTC_CONVERT_BCD2BIN((tr & (RTC_TR_HT | RTC_TR_HU)) >> 16);
+	*Minute = __RTC_CONVERT_BCD2BIN((tr & (RTC_TR_MNT | RTC_TR_MNU)) >> 8);
+	*Second = __RTC_CONVERT_BCD2BIN(tr & (RTC_TR_ST | RTC_TR_SU));
+}
+
+void RTC_Get_Date(uint16_t* Year, uint8_t* Month, uint8_t* Day) {
+	uint32_t dr;
+	(void) RTC->TR; // DR is frozen from here until it is read
+	dr = RTC->DR;
+	*Year = 2000U + __RTC_CONVERT_BCD2BIN((dr & (RTC_DR_YT | RTC_DR_YU)) >> 16);
+	*Month = __RTC_CONVERT_BCD2BIN((dr & (RTC_DR_MT | RTC_DR_MU)) >> 8);
+	*Day = __RTC_CONVERT_BCD2BIN(dr & (RTC_DR_DT | RTC_DR_DU));
+}
+
+// Time of day in 1/256 s ticks. Reading SSR freezes TR and DR in the shadow
+// registers until DR is read, so the three always belong together.
+uint32_t RTC_Get_Ticks(void) {
+	uint32_t ssr = RTC->SSR;
+	uint32_t tr = RTC->TR;
+	uint32_t seconds;
+	(void) RTC->DR; // unlock the shadow registers
+	
+	seconds = (((tr & RTC_TR_HT) >> 20) * 10 + ((tr & RTC_TR_HU) >> 16)) * 3600
+	        + (((tr & RTC_TR_MNT) >> 12) * 10 + ((tr & RTC_TR_MNU) >> 8)) * 60
+	        + ((tr & RTC_TR_ST) >> 4) * 10 + (tr & RTC_TR_SU);
+	// SSR counts down from PREDIV_S once per tick
+	return seconds * RTC_TICKS_PER_SECOND + (RTC_TICKS_PER_SECOND - 1U - (ssr & 0xFFU));
+}
+
 void RTC_Clock_Init(void) {
 	
 	// Enable write access to Backup domain
@@ -137,6 +230,13 @@ void RTC_Clock_Init(void) {
 		while((PWR->CR1 & PWR_CR1_DBP) == 0); // Wait for Backup domain Write protection disable
 	}
 	
+	// RTC already running from LSE: keep the backup domain, it holds the
+	// calendar and the cook checkpoint
+	if ((RCC->BDCR & (RCC_BDCR_RTCEN | RCC_BDCR_RTCSEL | RCC_BDCR_LSERDY)) == (RCC_BDCR_RTCEN | RCC_BDCR_RTCSEL_0 | RCC_BDCR_LSERDY)) {
+		RCC->APB1ENR1 &= ~RCC_APB1ENR1_PWREN; // Power interface clock disable
+		return;
+	}
+	
 	// Reset LSEON and LSEBYP bits before configuring the LSE
 	RCC->BDCR &= ~(RCC_BDCR_LSEON | RCC_BDCR_LSEBYP);
 
@@ -14,11 +14,32 @@
 #include "string.h"
 #include "stdio.h"
 
+// Helper macro to convert a value from 2 digit decimal format to BCD format
+#define __RTC_CONVERT_BIN2BCD(__VALUE__)   (uint8_t)((((__VALUE__) / 10) << 4) | ((__VALUE__) % 10))
+#define __RTC_CONVERT_BCD2BIN(__VALUE__) (uint8_t)(((uint8_t)((__VALUE__) & (uint8_t)0xF0) >> (uint8_t)0x4) * 10 + ((__VALUE__) & (uint8_t)0x0F))
+
+// Backup register map: 1 = calendar stamp, 2-6 = cook checkpoint, 7 = BLE baud
+#define RTC_BKP_STAMP_REG 1U
+#define RTC_BKP_STAMP     0x32F2U // value once the calendar has been set
+#define RTC_BKP_BAUD_REG  7U
+
+// Sub-second ticks with the default prescalers (PREDIV_A = 127, PREDIV_S = 255)
+#define RTC_TICKS_PER_SECOND 256U
+#define RTC_TICKS_PER_DAY    (86400U * RTC_TICKS_PER_SECOND)
+
 void RTC_Init(void);
+uint8_t RTC_WarmBoot(void);
 void RTC_Clock_Init(void);
 void RTC_Disable_Write_Protection(void);
 void RTC_Enable_Write_Protection(void);
 void RTC_Set_Calendar_Date(uint32_t WeekDay, uint32_t Day, uint32_t Month, uint32_t Year);
 void RTC_Set_Time(uint32_t Format12_24, uint32_t Hour, uint32_t Minute, uint32_t Second);
+void RTC_Set_Date(uint32_t Year, uint32_t Month, uint32_t Day);
+void RTC_Set_Clock(uint32_t Hour, uint32_t Minute, uint32_t Second);
+void RTC_Get_Clock(uint8_t* Hour, uint8_t* Minute, uint8_t* Second);
+void RTC_Get_Date(uint16_t* Year, uint8_t* Month, uint8_t* Day);
+uint32_t RTC_Get_Ticks(void);
+void RTC_BAK_SetRegister(uint32_t BackupRegister, uint32_t Data);
+uint32_t RTC_BAK_GetRegister(uint32_t BackupRegister);
 
 #endif
@@ -1,68 +1,196 @@
-#include "SysClock.h"
-
-void System_Clock_Init(void){
-	// Start LSE (for MSI PLL hardware calibration) 
-	RCC->APB1ENR1 |= RCC_APB1ENR1_PWREN; // Enable writing of Battery/Backup domain 
-	PWR->CR1 |= PWR_CR1_DBP;
-	
-	RCC->BDCR &= ~RCC_BDCR_LSEDRV; // Set LSE driving to medium effort 
-	RCC->BDCR |= RCC_BDCR_LSEDRV_1;
-	
-	RCC->BDCR |= RCC_BDCR_LSEON; // Start LSE 
-	
-	// Wait until LSE is ready 
-	while ((RCC->BDCR & RCC_BDCR_LSERDY) != RCC_BDCR_LSERDY);
-	
-	// Enable MSI PLL auto-calibration 
-	RCC->CR |= RCC_CR_MSIPLLEN;
-	
-	// Reset MSI range 
-	RCC->CR &= ~RCC_CR_MSIRANGE;
-	
-	// Set MSI range 
-	RCC->CR |= RCC_CR_MSIRANGE_6; // For 4MHz 
-	RCC->CR |= RCC_CR_MSIRGSEL; // MSI range is provided by CR register 
-	
-	// Start MSI 
-	RCC->CR |= RCC_CR_MSION;
-	
-	// Wait until MSI is ready 
-	while ((RCC->CR & RCC_CR_MSIRDY) != RCC_CR_MSIRDY);
-	
-	// Set voltage range 1 as MCU will run at 4MHz 
-	RCC->APB1ENR1 |= RCC_APB1ENR1_PWREN;
-	PWR->CR1 |= PWR_CR1_VOS_0;
-	PWR->CR1 &= ~PWR_CR1_VOS_1;
-
-	// Wait until VOSF bit is cleared (regulator ready) 
-	while ((PWR->SR2 & PWR_SR2_VOSF) == PWR_SR2_VOSF);
-
-	// Configure FLASH with prefetch and 0 WS 
-	FLASH->ACR |= FLASH_ACR_PRFTEN | FLASH_ACR_LATENCY_0WS;
-
-	// Configure AHB/APB prescalers
-	// AHB  Prescaler = /1	-> 4MHz
-	// APB1 Prescaler = /1  -> 4MHz
-	// APB2 Prescaler = /1  -> 4MHz
-	RCC->CFGR |= RCC_CFGR_HPRE_DIV1;
-	RCC->CFGR |= RCC_CFGR_PPRE2_DIV1;
-	RCC->CFGR |= RCC_CFGR_PPRE1_DIV1;
-
-	// Wait until MSI is ready 
-	while((RCC->CR & RCC_CR_MSIRDY) != RCC_CR_MSIRDY);
-
-	// Select the main MSI as system clock source 
-	RCC->CFGR &= ~RCC_CFGR_SW;
-	RCC->CFGR |= RCC_CFGR_SW_MSI;
-
-	// Wait until MSI is switched on 
-	while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_MSI);
-
-	// Set MSI as the CLK48 (actually 4MHz) clock source for SDMMC 
-	RCC->CCIPR |= RCC_CCIPR_CLK48SEL;
-
-	// Start RTC clock 
-	RCC->BDCR |= RCC_BDCR_LSCOSEL; // Select LSE as Low Speed Clock for RTC 
-	RCC->BDCR |= RCC_BDCR_RTCSEL_0; // Select LSE as RTC clock 
-	RCC->BDCR |= RCC_BDCR_RTCEN; // Enable RTC clock 
-}
+#include "SysClock.h"
+
+// Runtime clock profiles. Modules whose dividers depend on the clock
+// register a notifier: it is called before a switch to let transfers
+// finish, and after it (with interrupts still disabled) to reprogram.
+
+static SysClockNotifier notifiers[SYSCLOCK_MAX_NOTIFIERS];
+static uint8_t notifierCount;
+static SysClockProfile profile = SYSCLOCK_IDLE;
+
+SYSCLOCK_STATIC_ASSERT(SYSCLOCK_MSI_HZ / SYSCLOCK_PLLM >= 4000000U &&
+                       SYSCLOCK_MSI_HZ / SYSCLOCK_PLLM <= 16000000U, pll_input_4_to_16_mhz);
+SYSCLOCK_STATIC_ASSERT(SYSCLOCK_PLLM >= 1U && SYSCLOCK_PLLM <= 8U, pllm_1_to_8);
+SYSCLOCK_STATIC_ASSERT(SYSCLOCK_PLLN >= 8U && SYSCLOCK_PLLN <= 86U, plln_8_to_86);
+SYSCLOCK_STATIC_ASSERT(SYSCLOCK_MSI_HZ / SYSCLOCK_PLLM * SYSCLOCK_PLLN >= 64000000U &&
+                       SYSCLOCK_MSI_HZ / SYSCLOCK_PLLM * SYSCLOCK_PLLN <= 344000000U, vco_64_to_344_mhz);
+SYSCLOCK_STATIC_ASSERT(SYSCLOCK_PLLR == 2U || SYSCLOCK_PLLR == 4U ||
+                       SYSCLOCK_PLLR == 6U || SYSCLOCK_PLLR == 8U, pllr_2_4_6_8);
+SYSCLOCK_STATIC_ASSERT(SYSCLOCK_BURST_HZ <= 80000000U, sysclk_80_mhz_max);
+SYSCLOCK_STATIC_ASSERT(SYSCLOCK_WAIT_STATES(SYSCLOCK_BURST_HZ) <= 4U, flash_4_wait_states_max);
+
+void System_Clock_Init(void){
+	// Start LSE (for MSI PLL hardware calibration) 
+	RCC->APB1ENR1 |= RCC_APB1ENR1_PWREN; // Enable writing of Battery/Backup domain 
+	PWR->CR1 |= PWR_CR1_DBP;
+	
+	// LSE survives a system reset in the backup domain, only start it cold
+	if ((RCC->BDCR & RCC_BDCR_LSERDY) != RCC_BDCR_LSERDY) {
+		RCC->BDCR &= ~RCC_BDCR_LSEDRV; // Set LSE driving to medium effort 
+		RCC->BDCR |= RCC_BDCR_LSEDRV_1;
+		
+		RCC->BDCR |= RCC_BDCR_LSEON; // Start LSE 
+		
+		// Wait until LSE is ready 
+		while ((RCC->BDCR & RCC_BDCR_LSERDY) != RCC_BDCR_LSERDY);
+	}
+	
+	// Enable MSI PLL auto-calibration 
+	RCC->CR |= RCC_CR_MSIPLLEN;
+	
+	// Reset MSI range 
+	RCC->CR &= ~RCC_CR_MSIRANGE;
+	
+	// Set MSI range 
+	RCC->CR |= SYSCLOCK_MSI_RANGE << 4; // RCC_CR_MSIRANGE_6 for 4MHz 
+	RCC->CR |= RCC_CR_MSIRGSEL; // MSI range is provided by CR register 
+	
+	// Start MSI 
+	RCC->CR |= RCC_CR_MSION;
+	
+	// Wait until MSI is ready 
+	while ((RCC->CR & RCC_CR_MSIRDY) != RCC_CR_MSIRDY);
+	
+	// Set voltage range 1 as MCU will run at 4MHz 
+	RCC->APB1ENR1 |= RCC_APB1ENR1_PWREN;
+	PWR->CR1 |= PWR_CR1_VOS_0;
+	PWR->CR1 &= ~PWR_CR1_VOS_1;
+
+	// Wait until VOSF bit is cleared (regulator ready) 
+	while ((PWR->SR2 & PWR_SR2_VOSF) == PWR_SR2_VOSF);
+
+	// Configure FLASH with prefetch and 0 WS 
+	FLASH->ACR |= FLASH_ACR_PRFTEN | SYSCLOCK_WAIT_STATES(SYSCLOCK_IDLE_HZ);
+
+	// Configure AHB/APB prescalers
+	// AHB  Prescaler = /1	-> 4MHz
+	// APB1 Prescaler = /1  -> 4MHz
+	// APB2 Prescaler = /1  -> 4MHz
+	RCC->CFGR |= RCC_CFGR_HPRE_DIV1;
+	RCC->CFGR |= RCC_CFGR_PPRE2_DIV1;
+	RCC->CFGR |= SYSCLOCK_PPRE1(SYSCLOCK_IDLE_APB1);
+
+	// Wait until MSI is ready 
+	while((RCC->CR & RCC_CR_MSIRDY) != RCC_CR_MSIRDY);
+
+	// Select the main MSI as system clock source 
+	RCC->CFGR &= ~RCC_CFGR_SW;
+	RCC->CFGR |= RCC_CFGR_SW_MSI;
+
+	// Wait until MSI is switched on 
+	while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_MSI);
+
+	// Set MSI as the CLK48 (actually 4MHz) clock source for SDMMC 
+	RCC->CCIPR |= RCC_CCIPR_CLK48SEL;
+
+	// Start RTC clock 
+	RCC->BDCR |= RCC_BDCR_LSCOSEL; // Select LSE as Low Speed Clock for RTC 
+	RCC->BDCR |= RCC_BDCR_RTCSEL_0; // Select LSE as RTC clock 
+	RCC->BDCR |= RCC_BDCR_RTCEN; // Enable RTC clock 
+}
+
+// MSI frequency for each MSIRANGE setting
+static const uint32_t MSI_RANGE_HZ[] = {
+	100000U, 200000U, 400000U, 800000U, 1000000U, 2000000U,
+	4000000U, 8000000U, 16000000U, 24000000U, 32000000U, 48000000U
+};
+
+// Current SYSCLK frequency in Hz, read back from the RCC configuration
+uint32_t SysClock_GetFreq(void) {
+	uint32_t msi = MSI_RANGE_HZ[(RCC->CR & RCC_CR_MSIRANGE) >> 4];
+	uint32_t pllin, pllm, plln, pllr;
+	
+	switch (RCC->CFGR & RCC_CFGR_SWS) {
+		case RCC_CFGR_SWS_HSI:
+			return SYSCLOCK_HSI_HZ;
+		case RCC_CFGR_SWS_HSE:
+			return SYSCLOCK_HSE_HZ;
+		case RCC_CFGR_SWS_PLL:
+			switch (RCC->PLLCFGR & RCC_PLLCFGR_PLLSRC) {
+				case RCC_PLLCFGR_PLLSRC_HSI: pllin = SYSCLOCK_HSI_HZ; break;
+				case RCC_PLLCFGR_PLLSRC_HSE: pllin = SYSCLOCK_HSE_HZ; break;
+				default: pllin = msi; break;
+			}
+			pllm = ((RCC->PLLCFGR & RCC_PLLCFGR_PLLM) >> 4) + 1;
+			plln = (RCC->PLLCFGR & RCC_PLLCFGR_PLLN) >> 8;
+			pllr = (((RCC->PLLCFGR & RCC_PLLCFGR_PLLR) >> 25) + 1) * 2;
+			return pllin / pllm * plln / pllr;
+		default:
+			return msi;
+	}
+}
+
+// AHB divider, HPRE = 0xxx is /1, 1000 /2 up to 1011 /16, then 1100 /64 up to 1111 /512
+uint32_t SysClock_GetHCLK(void) {
+	uint32_t hpre = (RCC->CFGR & RCC_CFGR_HPRE) >> 4;
+	if (hpre < 8) return SysClock_GetFreq();
+	return SysClock_GetFreq() >> (hpre < 12 ? hpre - 7 : hpre - 6);
+}
+
+// APB1 divider, PPRE1 = 0xx is /1, 100 /2 up to 111 /16
+uint32_t SysClock_GetPCLK1(void) {
+	uint32_t ppre = (RCC->CFGR & RCC_CFGR_PPRE1) >> 8;
+	return ppre < 4 ? SysClock_GetHCLK() : SysClock_GetHCLK() >> (ppre - 3);
+}
+
+int8_t SysClock_Register(SysClockNotifier notifier) {
+	if (notifierCount == SYSCLOCK_MAX_NOTIFIERS) return -1;
+	notifiers[notifierCount++] = notifier;
+	return 0;
+}
+
+static void SysClock_Notify(SysClockEvent event) {
+	uint8_t i;
+	for (i = 0; i < notifierCount; i++) {
+		notifiers[i](event);
+	}
+}
+
+// Flash wait states for HCLK hz in voltage range 1
+static void SysClock_SetLatency(uint32_t hz) {
+	uint32_t ws = SYSCLOCK_WAIT_STATES(hz);
+	FLASH->ACR = (FLASH->ACR & ~FLASH_ACR_LATENCY) | ws;
+	while ((FLASH->ACR & FLASH_ACR_LATENCY) != ws); // must be in effect before the clock changes
+}
+
+// MSI / PLLM * PLLN / PLLR, 4 MHz / 1 * 40 / 2 = 80 MHz
+static void SysClock_StartPLL(void) {
+	if (RCC->CR & RCC_CR_PLLRDY) return;
+	RCC->PLLCFGR = RCC_PLLCFGR_PLLSRC_MSI | ((SYSCLOCK_PLLM - 1U) << 4) | (SYSCLOCK_PLLN << 8) |
+	               ((SYSCLOCK_PLLR / 2U - 1U) << 25) | RCC_PLLCFGR_PLLREN;
+	RCC->CR |= RCC_CR_PLLON;
+	while ((RCC->CR & RCC_CR_PLLRDY) != RCC_CR_PLLRDY);
+}
+
+// Switch SYSCLK between the profiles, from thread context only. Wait
+// states go up before the clock does and come down after it.
+void SysClock_SetProfile(SysClockProfile next) {
+	uint32_t primask;
+	
+	if (next == profile) return;
+	SysClock_Notify(SYSCLOCK_PRE_CHANGE);
+	if (next == SYSCLOCK_BURST) SysClock_StartPLL();
+	
+	primask = __get_PRIMASK();
+	__disable_irq();
+	if (next == SYSCLOCK_BURST) {
+		SysClock_SetLatency(SYSCLOCK_BURST_HZ);
+		RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_PPRE1) | SYSCLOCK_PPRE1(SYSCLOCK_BURST_APB1);
+		RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | RCC_CFGR_SW_PLL;
+		while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL);
+	} else {
+		RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | RCC_CFGR_SW_MSI;
+		while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_MSI);
+		RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_PPRE1) | SYSCLOCK_PPRE1(SYSCLOCK_IDLE_APB1);
+		SysClock_SetLatency(SYSCLOCK_IDLE_HZ);
+	}
+	profile = next;
+	SysClock_Notify(SYSCLOCK_POST_CHANGE);
+	__set_PRIMASK(primask);
+	
+	if (next == SYSCLOCK_IDLE) RCC->CR &= ~RCC_CR_PLLON; // PLL draws current even when unused
+}
+
+SysClockProfile SysClock_GetProfile(void) {
+	return profile;
+}
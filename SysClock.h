@@ -1,8 +1,66 @@
-#ifndef __STM32L476R_NUCLEO_CLOCK_H
-#define __STM32L476R_NUCLEO_CLOCK_H
-
-#include "stm32l476xx.h"
-
-void System_Clock_Init(void);
-
-#endif
+#ifndef __STM32L476R_NUCLEO_CLOCK_H
+#define __STM32L476R_NUCLEO_CLOCK_H
+
+#include "stm32l476xx.h"
+
+#define SYSCLOCK_HSI_HZ 16000000U
+#define SYSCLOCK_HSE_HZ 8000000U // ST-LINK MCO on the Nucleo board
+
+//===============================================================================
+//                           Clock Tree
+// The one description of the clocks. Dividers that depend on them (SysTick
+// LOAD, USART/LPUART BRR, I2C TIMINGR, flash wait states) are derived from
+// these values, and every module checks its own limits against both
+// profiles at compile time with SYSCLOCK_STATIC_ASSERT.
+//===============================================================================
+#define SYSCLOCK_MSI_RANGE  6U  // MSIRANGE, 4 MHz, trimmed by the LSE
+#define SYSCLOCK_PLLM       1U  // PLL input = MSI / PLLM, 4..16 MHz
+#define SYSCLOCK_PLLN       40U // VCO = input * PLLN, 64..344 MHz
+#define SYSCLOCK_PLLR       2U  // PLLCLK = VCO / PLLR, 2, 4, 6 or 8
+#define SYSCLOCK_IDLE_APB1  1U  // APB1 dividers, 1, 2, 4, 8 or 16
+#define SYSCLOCK_BURST_APB1 4U  // keeps LPUART1 BRR in range at 9600 baud
+
+#define SYSCLOCK_MSI_RANGE_HZ(r) ((r) <= 3U ? 100000U << (r) : (r) == 4U ? 1000000U : \
+                                  (r) == 5U ? 2000000U : (r) == 6U ? 4000000U :     \
+                                  (r) == 7U ? 8000000U : (r) == 8U ? 16000000U :    \
+                                  (r) == 9U ? 24000000U : (r) == 10U ? 32000000U : 48000000U)
+
+#define SYSCLOCK_MSI_HZ         SYSCLOCK_MSI_RANGE_HZ(SYSCLOCK_MSI_RANGE)
+#define SYSCLOCK_PLL_HZ         (SYSCLOCK_MSI_HZ / SYSCLOCK_PLLM * SYSCLOCK_PLLN / SYSCLOCK_PLLR)
+#define SYSCLOCK_IDLE_HZ        SYSCLOCK_MSI_HZ
+#define SYSCLOCK_IDLE_PCLK1_HZ  (SYSCLOCK_IDLE_HZ / SYSCLOCK_IDLE_APB1)
+#define SYSCLOCK_BURST_HZ       SYSCLOCK_PLL_HZ
+#define SYSCLOCK_BURST_PCLK1_HZ (SYSCLOCK_BURST_HZ / SYSCLOCK_BURST_APB1)
+
+#define SYSCLOCK_WS_HZ           16000000U // HCLK per flash wait state in voltage range 1
+#define SYSCLOCK_WAIT_STATES(hz) (((hz) - 1U) / SYSCLOCK_WS_HZ)
+// PPRE1 field for an APB1 divider: 0xx = /1, 100 = /2 ... 111 = /16
+#define SYSCLOCK_PPRE1(div)      ((div) == 1U ? 0U : (div) == 2U ? 4U << 8 : (div) == 4U ? 5U << 8 : \
+                                  (div) == 8U ? 6U << 8 : 7U << 8)
+
+// Fails to compile when cond is false, name says which limit was broken
+#define SYSCLOCK_STATIC_ASSERT(cond, name) typedef char sysclock_assert_##name[(cond) ? 1 : -1]
+
+#define SYSCLOCK_MAX_NOTIFIERS 8
+
+typedef enum {
+	SYSCLOCK_IDLE,  // MSI, SYSCLOCK_IDLE_HZ
+	SYSCLOCK_BURST  // PLL from MSI, SYSCLOCK_BURST_HZ
+} SysClockProfile;
+
+typedef enum {
+	SYSCLOCK_PRE_CHANGE,  // interrupts enabled, finish transfers in progress
+	SYSCLOCK_POST_CHANGE  // interrupts disabled, reprogram dividers for the new clock
+} SysClockEvent;
+
+typedef void (*SysClockNotifier)(SysClockEvent event);
+
+void System_Clock_Init(void);
+uint32_t SysClock_GetFreq(void);
+uint32_t SysClock_GetHCLK(void);
+uint32_t SysClock_GetPCLK1(void);
+int8_t SysClock_Register(SysClockNotifier notifier);
+void SysClock_SetProfile(SysClockProfile profile);
+SysClockProfile SysClock_GetProfile(void);
+
+#endif
@@ -1,23 +1,75 @@
-#include "SysTimer.h"
-
-volatile uint32_t timer;
-
-void SysTick_Init() {
-	// Setup ticks for 1ms period
-	SysTick->LOAD  = 3999UL; // set reload register
-	// Set Priority for Systick Interrupt
-	NVIC_SetPriority (SysTick_IRQn, 1);
-	// Enable SysTick IRQ and SysTick Timer
-	SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;
-}
-
-void SysTick_Handler(void) {
-	if (timer != 0) {
-		timer--;
-	}
-}
-
-void delay(uint32_t T) {
-	timer = T;
-	while(timer !=0);
-}
+#include "SysTimer.h"
+#include "power.h"
+#include "SysClock.h"
+#include "softtimer.h"
+
+volatile uint32_t timer;
+static volatile uint32_t msTicks; // milliseconds since SysTick_Init
+
+SYSCLOCK_STATIC_ASSERT(SYSTICK_LOAD(SYSCLOCK_BURST_HZ) <= 0xFFFFFFU, systick_load_24_bits);
+SYSCLOCK_STATIC_ASSERT(SYSCLOCK_IDLE_HZ % 1000U == 0 && SYSCLOCK_BURST_HZ % 1000U == 0, systick_exact_ms);
+
+// 1 ms period at the new HCLK, the tick in progress restarts
+static void SysTick_ClockChanged(SysClockEvent event) {
+	if (event != SYSCLOCK_POST_CHANGE) return;
+	SysTick->LOAD = SYSTICK_LOAD(SysClock_GetHCLK());
+	SysTick->VAL = 0;
+}
+
+void SysTick_Init() {
+	// Setup ticks for 1ms period
+	SysTick->LOAD  = SYSTICK_LOAD(SysClock_GetHCLK()); // set reload register, 3999 at 4MHz
+	SysClock_Register(SysTick_ClockChanged);
+	SoftTimer_Init();
+	// Set Priority for Systick Interrupt (highest, so the tick keeps running inside other ISRs)
+	NVIC_SetPriority (SysTick_IRQn, 0);
+	// Enable SysTick IRQ and SysTick Timer
+	SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;
+}
+
+void SysTick_Handler(void) {
+	msTicks++;
+	if (timer != 0) {
+		timer--;
+	}
+	SoftTimer_Tick();
+}
+
+uint32_t SysTick_GetTick(void) {
+	return msTicks;
+}
+
+// Microseconds since SysTick_Init (wraps after 71 minutes), from the tick
+// count and the current counter value. Also valid with interrupts disabled:
+// a reload that has not been serviced yet shows up as a pending SysTick.
+uint32_t SysTick_GetMicros(void) {
+	uint32_t ms, val, load = SysTick->LOAD;
+	uint32_t primask = __get_PRIMASK();
+	
+	__disable_irq();
+	ms = msTicks;
+	val = SysTick->VAL;
+	if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+		ms++;
+		val = SysTick->VAL; // the counter may have reloaded after the first read
+	}
+	__set_PRIMASK(primask);
+	return ms * 1000U + (load - val) * 1000U / (load + 1U);
+}
+
+// SysTick does not run in Stop mode, account for the time spent there
+void SysTick_Advance(uint32_t ms) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	msTicks += ms;
+	timer = timer > ms ? timer - ms : 0;
+	SoftTimer_Advance(ms);
+	__set_PRIMASK(primask);
+}
+
+void delay(uint32_t T) {
+	timer = T;
+	while(timer !=0) {
+		POWER_SLEEP_UNLESS(timer == 0); // SysTick wakes us every ms
+	}
+}
@@ -1,10 +1,15 @@
-#ifndef __STM32L476R_NUCLEO_SYSTICK_H
-#define __STM32L476R_NUCLEO_SYSTICK_H
-
-#include "stm32l4xx.h"
-
-void SysTick_Init (void);
-void SysTick_Handler(void);
-void delay (uint32_t T);
-
-#endif /* __STM32L476R_NUCLEO_DELAY_H */
+#ifndef __STM32L476R_NUCLEO_SYSTICK_H
+#define __STM32L476R_NUCLEO_SYSTICK_H
+
+#include "stm32l4xx.h"
+
+#define SYSTICK_LOAD(hclk) ((hclk) / 1000U - 1U) // 1 ms period, 24-bit counter
+
+void SysTick_Init (void);
+void SysTick_Handler(void);
+uint32_t SysTick_GetTick (void);
+uint32_t SysTick_GetMicros (void);
+void SysTick_Advance (uint32_t ms);
+void delay (uint32_t T);
+
+#endif /* __STM32L476R_NUCLEO_DELAY_H */
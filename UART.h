@@ -1,20 +1,34 @@
-#ifndef __STM32L476R_NUCLEO_UART_H
-#define __STM32L476R_NUCLEO_UART_H
-
-#include "stm32l476xx.h"
-
-#define BufferSize 32
-
-void UART1_Init(void);
-void UART1_GPIO_Init(void);
-
-
-void USART_Init(USART_TypeDef* USARTx);
-
-void USART1_IRQHandler(void);
-
-void USART_Write(USART_TypeDef * USARTx, uint8_t *buffer, uint32_t nBytes);
-uint8_t USART_Read(USART_TypeDef * USARTx);
-void USART_Delay(uint32_t us);
-
-#endif
+#ifndef __STM32L476R_NUCLEO_UART_H
+#define __STM32L476R_NUCLEO_UART_H
+
+#include "stm32l476xx.h"
+
+#define BufferSize 32
+
+#define USART_BAUD_DEFAULT 9600U
+
+#define USART_BAUD_MAX     115200U
+#define USART_BAUD_TOL     20U // permille the receiver tolerates with 16x oversampling
+
+// BRR for oversampling by 16, rounded to the nearest divider
+#define USART_BRR(clk, baud) (((clk) + (baud) / 2U) / (baud))
+// Deviation of the rate BRR actually gives from baud, in permille
+#define USART_BAUD_ERR(clk, baud) ((((clk) / USART_BRR(clk, baud) > (baud)) ? \
+	(clk) / USART_BRR(clk, baud) - (baud) : (baud) - (clk) / USART_BRR(clk, baud)) * 1000U / (baud))
+
+void UART1_Init(void);
+void UART1_GPIO_Init(void);
+
+
+void USART_Init(USART_TypeDef* USARTx);
+void USART_SetBaud(USART_TypeDef * USARTx, uint32_t baud);
+uint8_t USART_BaudSupported(uint32_t baud);
+
+void USART1_IRQHandler(void);
+
+void USART_Write(USART_TypeDef * USARTx, uint8_t *buffer, uint32_t nBytes);
+uint8_t USART_Read(USART_TypeDef * USARTx);
+int8_t USART_ReadTimeout(USART_TypeDef * USARTx, uint8_t *data, uint32_t timeout);
+void USART_Delay(uint32_t us);
+
+#endif
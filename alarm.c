@@ -1,7 +1,14 @@
 #include "RTC.h"
 #include "alarm.h"
 
-volatile uint16_t minutes = 0;
+// Cook timer, accumulated from the RTC calendar in 1/256 s ticks while
+// running. Each reading adds the time since the previous one, so pauses
+// keep every partial second and midnight only needs a modulo.
+static uint32_t cookTicks;     // accumulated while running
+static uint32_t cookLast;      // RTC time of day in ticks at the last update
+static uint8_t cookRunning;
+
+static volatile uint8_t alarmBFired;  // delayed start time reached
 
 void RTC_Set_Alarm(void) {
 	//disable both alarms
@@ -54,7 +61,10 @@ void RTC_Alarm_IRQHandler(void) {
 	// when alarm A is triggered, toggle LED
 	if (RTC->ISR & RTC_ISR_ALRAF) {
 		RTC->ISR &= ~RTC_ISR_ALRAF;
-		minutes++;
+	}
+	if (RTC->ISR & RTC_ISR_ALRBF) {
+		RTC->ISR &= ~RTC_ISR_ALRBF;
+		alarmBFired = 1;
 	}
 	// clear alarm event flag and interrupt pending bit
 	EXTI->PR1 |= EXTI_PR1_PIF18;
@@ -73,3 +83,76 @@ void Alarm_Disable(void) {
 	while ((RTC->ISR & RTC_ISR_ALRAWF) != RTC_ISR_ALRAWF);
 	RTC_Enable_Write_Protection();
 }
+
+// Alarm B: delayed start, fires once at hour:minute:00 on any date
+void Alarm_B_Set(uint8_t hour, uint8_t minute) {
+	RTC_Disable_Write_Protection();
+	RTC->CR &= ~(RTC_CR_ALRBE | RTC_CR_ALRBIE);
+	while ((RTC->ISR & RTC_ISR_ALRBWF) != RTC_ISR_ALRBWF);
+	
+	RTC->ALRMBR = RTC_ALRMBR_MSK4 // date/weekday don't care
+	            | ((uint32_t) __RTC_CONVERT_BIN2BCD(hour) << 16)
+	            | ((uint32_t) __RTC_CONVERT_BIN2BCD(minute) << 8);
+	RTC->ISR &= ~RTC_ISR_ALRBF;
+	alarmBFired = 0;
+	
+	RTC->CR |= RTC_CR_ALRBIE | RTC_CR_ALRBE;
+	RTC_Enable_Write_Protection();
+}
+
+void Alarm_B_Get(uint8_t* hour, uint8_t* minute) {
+	*hour = __RTC_CONVERT_BCD2BIN((RTC->ALRMBR & (RTC_ALRMBR_HT | RTC_ALRMBR_HU)) >> 16);
+	*minute = __RTC_CONVERT_BCD2BIN((RTC->ALRMBR & (RTC_ALRMBR_MNT | RTC_ALRMBR_MNU)) >> 8);
+}
+
+void Alarm_B_Disable(void) {
+	RTC_Disable_Write_Protection();
+	RTC->CR &= ~(RTC_CR_ALRBE | RTC_CR_ALRBIE);
+	RTC->ISR &= ~RTC_ISR_ALRBF;
+	RTC_Enable_Write_Protection();
+	alarmBFired = 0;
+}
+
+// Nonzero once alarm B has fired, also if it fired while we were in reset
+uint8_t Alarm_B_Pending(void) {
+	return alarmBFired || ((RTC->CR & RTC_CR_ALRBE) && (RTC->ISR & RTC_ISR_ALRBF));
+}
+
+static void CookTimer_Update(void) {
+	uint32_t now = RTC_Get_Ticks();
+	if (cookRunning) {
+		cookTicks += (now + RTC_TICKS_PER_DAY - cookLast) % RTC_TICKS_PER_DAY;
+	}
+	cookLast = now;
+}
+
+void CookTimer_Start(void) {
+	CookTimer_Update();
+	cookRunning = 1;
+}
+
+void CookTimer_Pause(void) {
+	CookTimer_Update();
+	cookRunning = 0;
+}
+
+void CookTimer_Reset(void) {
+	cookRunning = 0;
+	cookTicks = 0;
+}
+
+// Seconds spent cooking, polled at least once a day while running
+uint32_t CookTimer_Elapsed(void) {
+	return CookTimer_Ticks() / RTC_TICKS_PER_SECOND;
+}
+
+uint32_t CookTimer_Ticks(void) {
+	CookTimer_Update();
+	return cookTicks;
+}
+
+// Continue from a checkpoint, stopped; CookTimer_Start resumes counting
+void CookTimer_Restore(uint32_t ticks) {
+	cookRunning = 0;
+	cookTicks = ticks;
+}
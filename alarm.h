@@ -1,9 +1,23 @@
 #ifndef __STM32L476G_NUCLEO_ALARM_H
 #define __STM32L476G_NUCLEO_ALARM_H
 
+#include <stdint.h>
+
 void RTC_Set_Alarm(void);
 void RTC_Alarm_Enable(void);
 void Alarm_Enable(void);
 void Alarm_Disable(void);
 
+void Alarm_B_Set(uint8_t hour, uint8_t minute);
+void Alarm_B_Get(uint8_t* hour, uint8_t* minute);
+void Alarm_B_Disable(void);
+uint8_t Alarm_B_Pending(void);
+
+void CookTimer_Start(void);
+void CookTimer_Pause(void);
+void CookTimer_Reset(void);
+uint32_t CookTimer_Elapsed(void);
+uint32_t CookTimer_Ticks(void);
+void CookTimer_Restore(uint32_t ticks);
+
 #endif
@@ -0,0 +1,35 @@
+#include "boot.h"
+#include "SysClock.h"
+
+static const char* PHASE2STR[BOOT_PHASES] = {
+	"START", "CLOCK", "RTC", "RESUME", "CONSOLE", "SENSOR", "DISPLAY", "CONTROL"
+};
+
+static uint32_t stamp[BOOT_PHASES]; // CYCCNT at each phase, 0 = not reached
+static uint32_t clockHz[BOOT_PHASES];
+
+// Start the cycle counter, first thing in main
+void Boot_Init(void) {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	Boot_Mark(BOOT_START);
+}
+
+// Record the first time a phase is reached
+void Boot_Mark(BootPhase phase) {
+	if (stamp[phase] != 0) return;
+	stamp[phase] = DWT->CYCCNT;
+	clockHz[phase] = SysClock_GetHCLK(); // CYCCNT counts HCLK cycles
+}
+
+// Microseconds from reset to phase, 0 if not reached yet. Cycles are
+// converted at the clock in effect when the phase was reached.
+uint32_t Boot_Micros(BootPhase phase) {
+	if (phase != BOOT_START && stamp[phase] == 0) return 0;
+	return (uint32_t) ((uint64_t) stamp[phase] * 1000000U / clockHz[phase]);
+}
+
+const char* Boot_Name(BootPhase phase) {
+	return PHASE2STR[phase];
+}
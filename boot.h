@@ -0,0 +1,24 @@
+#ifndef __STM32L476R_NUCLEO_BOOT_H
+#define __STM32L476R_NUCLEO_BOOT_H
+
+#include <stdint.h>
+
+// Boot milestones, timestamped with the DWT cycle counter
+typedef enum {
+	BOOT_START,         // first instruction of main
+	BOOT_CLOCK,         // system clock configured
+	BOOT_RTC,           // RTC and backup domain usable
+	BOOT_RESUME,        // checkpoint restored, relay driven
+	BOOT_CONSOLE,       // USART1 and HM-10 ready
+	BOOT_SENSOR,        // DS18B20 link up
+	BOOT_DISPLAY,       // LCD initialized
+	BOOT_CONTROL,       // first pass of the control state machine
+	BOOT_PHASES
+} BootPhase;
+
+void Boot_Init(void);
+void Boot_Mark(BootPhase phase);
+uint32_t Boot_Micros(BootPhase phase);
+const char* Boot_Name(BootPhase phase);
+
+#endif
@@ -0,0 +1,68 @@
+#include "checkpoint.h"
+#include "RTC.h"
+
+// Only the words that changed are written, the CRC last. A reset in the
+// middle of an update leaves a CRC mismatch and the checkpoint is ignored.
+
+typedef union {
+	float f;
+	uint32_t u;
+} Word;
+
+// CRC-32 (0x04C11DB7, init 0xFFFFFFFF) from the CRC unit
+static uint32_t Checkpoint_CRC(const uint32_t* data, uint8_t count) {
+	RCC->AHB1ENR |= RCC_AHB1ENR_CRCEN;
+	CRC->CR = CRC_CR_RESET;
+	while (count--) {
+		CRC->DR = *data++;
+	}
+	return CRC->DR;
+}
+
+static void Checkpoint_Pack(const Checkpoint* cp, uint32_t* words) {
+	Word w;
+	words[0] = (CHECKPOINT_VERSION << 24) | ((uint32_t) cp->status << 16) | cp->cookingTime;
+	w.f = cp->setpoint;
+	words[1] = w.u;
+	w.f = cp->integrator;
+	words[2] = w.u;
+	words[3] = cp->elapsedTicks;
+}
+
+void Checkpoint_Save(const Checkpoint* cp) {
+	uint32_t words[CHECKPOINT_WORDS];
+	uint8_t i, changed = 0;
+
+	Checkpoint_Pack(cp, words);
+	for (i = 0; i < CHECKPOINT_WORDS; i++) {
+		if (RTC_BAK_GetRegister(CHECKPOINT_FIRST_REG + i) != words[i]) {
+			RTC_BAK_SetRegister(CHECKPOINT_FIRST_REG + i, words[i]);
+			changed = 1;
+		}
+	}
+	if (changed) {
+		RTC_BAK_SetRegister(CHECKPOINT_FIRST_REG + CHECKPOINT_WORDS, Checkpoint_CRC(words, CHECKPOINT_WORDS));
+	}
+}
+
+// Returns 0 and fills cp if the backup registers hold a valid checkpoint
+int8_t Checkpoint_Load(Checkpoint* cp) {
+	uint32_t words[CHECKPOINT_WORDS];
+	uint8_t i;
+	Word w;
+
+	for (i = 0; i < CHECKPOINT_WORDS; i++) {
+		words[i] = RTC_BAK_GetRegister(CHECKPOINT_FIRST_REG + i);
+	}
+	if ((words[0] >> 24) != CHECKPOINT_VERSION) return -1;
+	if (RTC_BAK_GetRegister(CHECKPOINT_FIRST_REG + CHECKPOINT_WORDS) != Checkpoint_CRC(words, CHECKPOINT_WORDS)) return -1;
+
+	cp->status = (words[0] >> 16) & 0xFFU;
+	cp->cookingTime = words[0] & 0xFFFFU;
+	w.u = words[1];
+	cp->setpoint = w.f;
+	w.u = words[2];
+	cp->integrator = w.f;
+	cp->elapsedTicks = words[3];
+	return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef __STM32L476R_NUCLEO_CHECKPOINT_H
+#define __STM32L476R_NUCLEO_CHECKPOINT_H
+
+#include <stdint.h>
+
+// Cook state kept in the RTC backup registers so a reset or brown-out can
+// pick up where it left off. BKP1R is the calendar stamp, the checkpoint
+// uses BKP2R-BKP6R: four data words and their CRC.
+#define CHECKPOINT_FIRST_REG  2U
+#define CHECKPOINT_WORDS      4U
+#define CHECKPOINT_VERSION    0xC1U
+#define CHECKPOINT_PERIOD_MS  1000U // refresh interval of the elapsed time
+
+typedef struct {
+	uint8_t status;
+	uint16_t cookingTime;   // minutes
+	float setpoint;         // Celsius
+	float integrator;       // PID error sum
+	uint32_t elapsedTicks;  // cook timer, 1/256 s
+} Checkpoint;
+
+void Checkpoint_Save(const Checkpoint* cp);
+int8_t Checkpoint_Load(Checkpoint* cp);
+
+#endif
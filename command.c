@@ -0,0 +1,232 @@
+#include "command.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Console command registry.
+// The command table is a const array supplied by the application. At init
+// every entry (plus the built-in HELP) is placed into an open addressed hash
+// index, so lookup cost does not grow with the number of commands.
+//
+// A line may carry several commands separated by ';' and start with a
+// correlation ID, e.g. "#7 TEMP 140; TIME 2 0; START". Every command is
+// looked up and its arguments parsed, then every handler checks its values
+// before any of them acts or replies, so a rejected line leaves no
+// misleading replies behind. Every reply line is prefixed with the ID, and
+// every line ends with "OK" or "ERROR" ("#7 OK" or "#7 ERROR" if tagged).
+
+static const Command* commands;
+static uint8_t commandCount;
+static const Command* slots[COMMAND_HASH_SIZE];
+static char tag[COMMAND_TAG_SIZE];
+static uint8_t checking;
+
+// Parsed commands of the current line
+static const Command* batch[COMMAND_MAX_BATCH];
+static CommandArg batchArgs[COMMAND_MAX_BATCH][COMMAND_MAX_ARGS];
+static int batchArgc[COMMAND_MAX_BATCH];
+static uint8_t batchCount;
+static int8_t resolved; // Command_Resolve result for the current line
+
+static int8_t Command_Help(int argc, const CommandArg* argv);
+static const Command help = {"HELP", "", Command_Help, "list commands"};
+
+// FNV-1a over the command name
+static uint32_t Command_Hash(const char* name, uint8_t len) {
+	uint32_t hash = 2166136261U;
+	while (len--) {
+		hash ^= (uint8_t) *name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static void Command_Insert(const Command* cmd) {
+	uint32_t h = Command_Hash(cmd->name, strlen(cmd->name)) & (COMMAND_HASH_SIZE - 1);
+	while (slots[h] != NULL) {
+		h = (h + 1) & (COMMAND_HASH_SIZE - 1);
+	}
+	slots[h] = cmd;
+}
+
+static const Command* Command_Find(const char* name) {
+	uint8_t len = strlen(name);
+	uint32_t h = Command_Hash(name, len) & (COMMAND_HASH_SIZE - 1);
+	while (slots[h] != NULL) {
+		if (strcmp(slots[h]->name, name) == 0) return slots[h];
+		h = (h + 1) & (COMMAND_HASH_SIZE - 1);
+	}
+	return NULL;
+}
+
+void Command_Init(const Command* table, uint8_t count) {
+	uint8_t i;
+	commands = table;
+	commandCount = count;
+	memset(slots, 0, sizeof(slots));
+	for (i = 0; i < count; i++) {
+		Command_Insert(&table[i]);
+	}
+	Command_Insert(&help);
+}
+
+// Reply to the current line, prefixed with its correlation ID if it had one
+void Command_Reply(const char* format, ...) {
+	va_list args;
+	if (tag[0] != '\0') {
+		printf("#%s ", tag);
+	}
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+}
+
+// Nonzero while the handlers of a line only check their arguments
+uint8_t Command_Checking(void) {
+	return checking;
+}
+
+static char* Command_Usage(const Command* cmd) {
+	static char usage[48];
+	const char* a;
+	uint8_t len, optional = 0;
+	len = snprintf(usage, sizeof(usage), "%s", cmd->name);
+	for (a = cmd->args; *a && len < sizeof(usage); a++) {
+		if (*a == '|') {
+			optional = 1;
+			continue;
+		}
+		len += snprintf(usage + len, sizeof(usage) - len, optional ? " [%s]" : " <%s>",
+						*a == 'i' ? "int" : *a == 'f' ? "num" : "word");
+	}
+	return usage;
+}
+
+static int8_t Command_Help(int argc, const CommandArg* argv) {
+	uint8_t i;
+	if (checking) return COMMAND_OK;
+	for (i = 0; i <= commandCount; i++) {
+		const Command* cmd = i < commandCount ? &commands[i] : &help;
+		Command_Reply("%s - %s\n", Command_Usage(cmd), cmd->help);
+	}
+	return COMMAND_OK;
+}
+
+// Convert the remaining tokens according to the command's schema
+static int8_t Command_Parse(const Command* cmd, int* argc, CommandArg* argv) {
+	const char* a = cmd->args;
+	char* tok;
+	char* end;
+	uint8_t optional = 0;
+
+	*argc = 0;
+	while ((tok = strtok(NULL, " \t\r\n")) != NULL) {
+		if (*a == '|') {
+			optional = 1;
+			a++;
+		}
+		if (*a == '\0' || *argc >= COMMAND_MAX_ARGS) return -1; // too many arguments
+		switch (*a) {
+			case 'i':
+				argv[*argc].i = strtol(tok, &end, 10);
+				if (*end != '\0') return -1;
+				break;
+			case 'f':
+				argv[*argc].f = strtod(tok, &end);
+				if (*end != '\0') return -1;
+				break;
+			default:
+				argv[*argc].s = tok;
+				break;
+		}
+		(*argc)++;
+		a++;
+	}
+	if (*a != '\0' && *a != '|' && !optional) return -1; // missing arguments
+	return 0;
+}
+
+// Strip an optional "#id" prefix into tag
+static char* Command_Tag(char* line) {
+	uint8_t len = 0;
+	tag[0] = '\0';
+	line += strspn(line, " \t");
+	if (*line != '#') return line;
+	line++;
+	while (*line != '\0' && *line != ' ' && *line != '\t' && *line != ';') {
+		if (len < COMMAND_TAG_SIZE - 1) tag[len++] = *line;
+		line++;
+	}
+	tag[len] = '\0';
+	return line;
+}
+
+// Look up every command of a line and parse its arguments, nothing runs
+// yet. COMMAND_INVALID if a name is unknown, e.g. noise at the wrong baud
+// rate; Command_Execute then runs the line.
+int8_t Command_Resolve(char* line) {
+	char* segment[COMMAND_MAX_BATCH];
+	char* name;
+	uint8_t segments = 1, count = 0, i;
+	int8_t result = COMMAND_OK;
+
+	segment[0] = Command_Tag(line);
+	for (line = segment[0]; *line != '\0'; line++) {
+		if (*line != ';') continue;
+		*line = '\0';
+		if (segments == COMMAND_MAX_BATCH) {
+			Command_Reply("TOO MANY COMMANDS\n");
+			result = COMMAND_REJECTED;
+			break;
+		}
+		segment[segments++] = line + 1;
+	}
+
+	// Resolve and parse everything first
+	for (i = 0; i < segments && result == COMMAND_OK; i++) {
+		name = strtok(segment[i], " \t\r\n");
+		if (name == NULL) continue; // empty segment, e.g. trailing ';'
+		batch[count] = Command_Find(name);
+		if (batch[count] == NULL) {
+			Command_Reply("INVALID COMMAND\n");
+			result = COMMAND_INVALID;
+		} else if (Command_Parse(batch[count], &batchArgc[count], batchArgs[count]) != 0) {
+			Command_Reply("INVALID ARGUMENTS, USAGE: %s\n", Command_Usage(batch[count]));
+			result = COMMAND_REJECTED;
+		} else {
+			count++;
+		}
+	}
+	batchCount = count;
+	resolved = result;
+	return result;
+}
+
+// Number of commands on the current line
+uint8_t Command_Count(void) {
+	return batchCount;
+}
+
+// Run the line given to Command_Resolve, all of its commands or none of them
+int8_t Command_Execute(void) {
+	int8_t result = resolved;
+	uint8_t i;
+
+	// Check every value, then act
+	checking = 1;
+	for (i = 0; i < batchCount && result == COMMAND_OK; i++) {
+		if (batch[i]->handler(batchArgc[i], batchArgs[i]) != COMMAND_OK) {
+			result = COMMAND_REJECTED;
+		}
+	}
+	checking = 0;
+	for (i = 0; i < batchCount && result == COMMAND_OK; i++) {
+		if (batch[i]->handler(batchArgc[i], batchArgs[i]) != COMMAND_OK) {
+			result = COMMAND_REJECTED;
+		}
+	}
+
+	Command_Reply(result == COMMAND_OK ? "OK\n" : "ERROR\n");
+	return result;
+}
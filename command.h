@@ -0,0 +1,45 @@
+#ifndef __STM32L476R_NUCLEO_COMMAND_H
+#define __STM32L476R_NUCLEO_COMMAND_H
+
+#include <stdint.h>
+
+#define COMMAND_MAX_ARGS   4
+#define COMMAND_MAX_BATCH  8  // commands per line, separated by ';'
+#define COMMAND_TAG_SIZE   9  // correlation ID, '#' + up to 8 characters
+#define COMMAND_HASH_SIZE  64 // power of 2, at least twice the number of commands
+
+#define COMMAND_OK         0
+#define COMMAND_REJECTED   1  // known commands, but arguments or values refused
+#define COMMAND_INVALID    (-1)
+
+typedef union {
+	int32_t i;
+	double f;
+	const char* s;
+} CommandArg;
+
+// Returns COMMAND_OK, or COMMAND_REJECTED to abandon the rest of the line.
+// Every handler of a line is called once while Command_Checking() is set
+// and again after all of them accepted: while checking, a handler may only
+// validate, reply why it refuses and stage values, nothing else. Effects
+// that cannot be staged belong alone on their line, see Command_Count().
+typedef int8_t (*CommandHandler)(int argc, const CommandArg* argv);
+
+// Argument schema, one letter per argument:
+//   i = integer, f = number, w = word
+// arguments after a '|' are optional, e.g. "i|i" takes one or two integers
+typedef struct {
+	const char* name;
+	const char* args;
+	CommandHandler handler;
+	const char* help;
+} Command;
+
+void Command_Init(const Command* table, uint8_t count);
+int8_t Command_Resolve(char* line);
+int8_t Command_Execute(void);
+uint8_t Command_Count(void);
+void Command_Reply(const char* format, ...);
+uint8_t Command_Checking(void);
+
+#endif
@@ -0,0 +1,87 @@
+#include "console.h"
+#include "UART.h"
+#include "command.h"
+#include <ctype.h>
+#include <string.h>
+
+// Bluetooth console input.
+// The USART1 ISR only assembles characters into lines; complete lines are
+// queued so a client can pipeline requests, and are executed by the main
+// loop between state machine steps. Lines that cannot be queued are
+// remembered by their correlation ID so the client gets a reply.
+
+static char rxLine[CONSOLE_LINE_SIZE];
+static uint8_t rxLen, rxLong;
+
+static char lines[CONSOLE_LINES][CONSOLE_LINE_SIZE];
+static volatile uint8_t head, tail;
+
+static char refusedTag[CONSOLE_LINES][COMMAND_TAG_SIZE];
+static uint8_t refusedWhy[CONSOLE_LINES];
+static volatile uint8_t refusedHead, refusedTail;
+
+// Note a line that was not queued, with its "#id" prefix if it had one
+static void Console_Refuse(uint8_t why) {
+	char* tag;
+	uint8_t i = 0, len = 0;
+
+	if ((uint8_t)(refusedHead - refusedTail) == CONSOLE_LINES) return; // client is flooding us
+	tag = refusedTag[refusedHead & (CONSOLE_LINES - 1)];
+	while (i < rxLen && (rxLine[i] == ' ' || rxLine[i] == '\t')) i++;
+	if (i < rxLen && rxLine[i] == '#') {
+		for (i++; i < rxLen && len < COMMAND_TAG_SIZE - 1; i++) {
+			if (rxLine[i] == ' ' || rxLine[i] == '\t' || rxLine[i] == ';') break;
+			tag[len++] = rxLine[i];
+		}
+	}
+	tag[len] = '\0';
+	refusedWhy[refusedHead & (CONSOLE_LINES - 1)] = why;
+	refusedHead++;
+}
+
+void USART1_IRQHandler(void) {
+	char c;
+	if (USART1->ISR & USART_ISR_ORE) {
+		USART1->ICR = USART_ICR_ORECF;
+	}
+	if (USART1->ISR & USART_ISR_RXNE) {
+		c = (char) (USART1->RDR & 0xFF); // reading RDR clears RXNE
+		if (c == '\n' || c == '\r') {
+			// drop empty lines (CR LF), refuse lines that were cut off or do not fit in the queue
+			if (rxLong) {
+				Console_Refuse(CONSOLE_TOO_LONG);
+			} else if (rxLen != 0 && (uint8_t)(head - tail) == CONSOLE_LINES) {
+				Console_Refuse(CONSOLE_BUSY);
+			} else if (rxLen != 0) {
+				rxLine[rxLen] = '\0';
+				memcpy(lines[head & (CONSOLE_LINES - 1)], rxLine, rxLen + 1);
+				head++;
+			}
+			rxLen = 0;
+			rxLong = 0;
+		} else if (rxLen < CONSOLE_LINE_SIZE - 1) {
+			rxLine[rxLen++] = toupper(c);
+		} else {
+			rxLong = 1;
+		}
+	}
+}
+
+// Copy the oldest complete line into line, returns 0 if there is none
+uint8_t Console_GetLine(char* line) {
+	if (head == tail) return 0;
+	memcpy(line, lines[tail & (CONSOLE_LINES - 1)], CONSOLE_LINE_SIZE);
+	tail++;
+	return 1;
+}
+
+// Oldest line that was not queued: copies its ID (without '#', empty if it
+// had none) into tag and returns CONSOLE_BUSY or CONSOLE_TOO_LONG, 0 if none
+uint8_t Console_GetRefused(char* tag) {
+	uint8_t why;
+	if (refusedHead == refusedTail) return 0;
+	memcpy(tag, refusedTag[refusedTail & (CONSOLE_LINES - 1)], COMMAND_TAG_SIZE);
+	why = refusedWhy[refusedTail & (CONSOLE_LINES - 1)];
+	refusedTail++;
+	return why;
+}
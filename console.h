@@ -0,0 +1,16 @@
+#ifndef __STM32L476R_NUCLEO_CONSOLE_H
+#define __STM32L476R_NUCLEO_CONSOLE_H
+
+#include <stdint.h>
+
+#define CONSOLE_LINE_SIZE  128
+#define CONSOLE_LINES      4   // complete lines waiting for the main loop, power of 2
+
+// Why a line was not queued, see Console_GetRefused
+#define CONSOLE_BUSY       1   // queue full
+#define CONSOLE_TOO_LONG   2   // longer than CONSOLE_LINE_SIZE - 1 characters
+
+uint8_t Console_GetLine(char* line);
+uint8_t Console_GetRefused(char* tag);
+
+#endif
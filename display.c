@@ -0,0 +1,142 @@
+#include "display.h"
+#include "I2C.h"
+#include "SysTimer.h"
+#include <stdio.h>
+#include <stdarg.h>
+
+// 20x4 shadow framebuffer.
+// Rows are rendered into frame[], panel[] holds what the LCD is known to
+// show. A refresh sends only the cells that differ and moves the cursor
+// only when the next changed cell is not where the HD44780 left it.
+// Everything is sent as one batched I2C transaction; the refresh is a
+// protothread that yields while the batch buffer or I2C queue is full.
+//
+// Refreshes are paced by Display_Due rather than the main loop: the
+// application renders and refreshes only when it returns 1, after its
+// sensing and control work. Without activity the rate drops to
+// DISPLAY_IDLE_PERIOD_MS and the backlight goes off.
+
+#define CURSOR_UNKNOWN 0xFFU
+
+// DDRAM address of the first column of each row on a 2004 panel
+static const uint8_t ROW_ADDRESS[DISPLAY_ROWS] = {0x00, 0x40, 0x14, 0x54};
+
+static char frame[DISPLAY_ROWS][DISPLAY_COLS];
+static char panel[DISPLAY_ROWS][DISPLAY_COLS];
+static uint8_t cursor = CURSOR_UNKNOWN; // DDRAM address of the next write
+
+static uint32_t period = 1000U / DISPLAY_RATE_DEFAULT;
+static uint32_t lastRefresh, lastActivity;
+static uint8_t idle;
+
+static void Display_Fill(char buf[DISPLAY_ROWS][DISPLAY_COLS], char c) {
+	uint8_t row, col;
+	for (row = 0; row < DISPLAY_ROWS; row++) {
+		for (col = 0; col < DISPLAY_COLS; col++) {
+			buf[row][col] = c;
+		}
+	}
+}
+
+// Glyph n lights the bottom n + 1 pixel rows
+static void Display_LoadBars(void) {
+	uint8_t pattern[8];
+	uint8_t glyph, row;
+	for (glyph = 0; glyph < DISPLAY_BAR_LEVELS; glyph++) {
+		for (row = 0; row < 8; row++) {
+			pattern[row] = row >= 7 - glyph ? 0x1F : 0x00;
+		}
+		LCD_CreateChar(glyph, pattern);
+	}
+}
+
+void Display_Init(void) {
+	Display_LoadBars();
+	LCD_Clear(); // also moves the address counter back to DDRAM
+	Display_Fill(panel, ' ');
+	Display_Fill(frame, ' ');
+	cursor = ROW_ADDRESS[0];
+	lastActivity = SysTick_GetTick();
+}
+
+// Nonzero when the next refresh is due, called from the main loop
+uint8_t Display_Due(void) {
+	uint32_t now = SysTick_GetTick();
+
+	if (!idle && now - lastActivity >= DISPLAY_IDLE_AFTER_MS) {
+		idle = 1;
+		LCD_BL(false);
+	}
+	if (now - lastRefresh < (idle ? DISPLAY_IDLE_PERIOD_MS : period)) return 0;
+	lastRefresh = now;
+	return 1;
+}
+
+int8_t Display_SetRate(uint8_t hz) {
+	if (hz == 0 || hz > DISPLAY_RATE_MAX) return -1;
+	period = 1000U / hz;
+	return 0;
+}
+
+// User interaction or a state change, leaves idle mode and refreshes at once
+void Display_Activity(void) {
+	lastActivity = SysTick_GetTick();
+	if (idle) {
+		idle = 0;
+		LCD_BL(true);
+	}
+	lastRefresh = lastActivity - period;
+}
+
+// Render a row (1-indexed, like LCD_Locate), padded with spaces
+void Display_Printf(uint8_t row, const char* format, ...) {
+	char text[DISPLAY_COLS + 1];
+	va_list args;
+	uint8_t col = 0;
+
+	if (row < 1 || row > DISPLAY_ROWS) return;
+	va_start(args, format);
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+
+	while (col < DISPLAY_COLS && text[col] != '\0') {
+		frame[row - 1][col] = text[col];
+		col++;
+	}
+	while (col < DISPLAY_COLS) {
+		frame[row - 1][col++] = ' ';
+	}
+}
+
+static uint8_t Display_Changed(uint8_t row, uint8_t col) {
+	return frame[row][col] != panel[row][col];
+}
+
+// Send frame[] to the panel. Runs until PT_ENDED, frame[] must not change
+// meanwhile.
+PT_THREAD(Display_Refresh(Pt* pt)) {
+	static uint8_t row, col;
+	uint8_t address;
+
+	PT_BEGIN(pt);
+	for (row = 0; row < DISPLAY_ROWS; row++) {
+		for (col = 0; col < DISPLAY_COLS; col++) {
+			address = ROW_ADDRESS[row] + col;
+			if (!Display_Changed(row, col)) {
+				// rewriting one unchanged cell costs the same as a cursor move
+				if (cursor != address || col + 1 >= DISPLAY_COLS || !Display_Changed(row, col + 1)) continue;
+			}
+			if (cursor != address) {
+				PT_WAIT_UNTIL(pt, LCD_Batch_Ready());
+				LCD_Batch_CMD(0x80 | (ROW_ADDRESS[row] + col)); // set DDRAM address
+			}
+			PT_WAIT_UNTIL(pt, LCD_Batch_Ready());
+			LCD_Batch_Data(frame[row][col]);
+			panel[row][col] = frame[row][col];
+			cursor = col + 1 < DISPLAY_COLS ? ROW_ADDRESS[row] + col + 1 : CURSOR_UNKNOWN;
+		}
+	}
+	PT_WAIT_UNTIL(pt, LCD_Batch_Ready());
+	LCD_Batch_Send(); // all changes in one I2C transaction
+	PT_END(pt);
+}
@@ -0,0 +1,29 @@
+#ifndef __STM32L476R_NUCLEO_DISPLAY_H
+#define __STM32L476R_NUCLEO_DISPLAY_H
+
+#include <stdint.h>
+#include "pt.h"
+
+#define DISPLAY_ROWS 4
+#define DISPLAY_COLS 20
+
+// Vertical bar glyphs in CGRAM, level 1 (one pixel row) to 8 (full cell).
+// CGRAM 0-7 is also addressed by codes 8-15, which keeps NUL out of strings.
+#define DISPLAY_GLYPH_BASE    8U
+#define DISPLAY_BAR_LEVELS    8U
+#define DISPLAY_BAR(level)    ((char) (DISPLAY_GLYPH_BASE + (level) - 1U))
+
+#define DISPLAY_RATE_DEFAULT  4U     // refreshes per second
+#define DISPLAY_RATE_MAX      10U
+#define DISPLAY_POLL_MS       (1000U / DISPLAY_RATE_MAX) // how often Display_Due is asked
+#define DISPLAY_IDLE_PERIOD_MS 2000U // refresh period once idle
+#define DISPLAY_IDLE_AFTER_MS 60000U // no activity for this long turns the backlight off
+
+void Display_Init(void);
+void Display_Printf(uint8_t row, const char* format, ...);
+PT_THREAD(Display_Refresh(Pt* pt));
+uint8_t Display_Due(void);
+int8_t Display_SetRate(uint8_t hz);
+void Display_Activity(void);
+
+#endif
@@ -1,20 +1,31 @@
-#ifndef __STM32L476R_NUCLEO_DS18B20_H
-#define __STM32L476R_NUCLEO_DS18B20_H
-
-#include "stm32l4xx.h"
-
-void DS18B20_GPIO_Init (void);
-
-void DS18B20_TX_DMA_Init (void);
-void DS18B20_RX_DMA_Init (void);
-
-void DS18B20_LPUART1_Init (void);
-void DS18B20_LPUART1_Enable (void);
-
-uint8_t DS18B20_CMDReset (void);
-void DS18B20_CMDTransmit (const uint8_t * cmd, uint8_t size);
-void DS18B20_CMDReceive (const uint8_t * cmd, uint8_t size);
-
-void DS18B20_Process (void);
-
-#endif
+#ifndef __STM32L476R_NUCLEO_DS18B20_H
+#define __STM32L476R_NUCLEO_DS18B20_H
+
+#include "stm32l4xx.h"
+#include "pt.h"
+
+#define DS18B20_RESET_BAUD 9600U   // one byte is a 1-Wire reset and presence slot
+#define DS18B20_DATA_BAUD  115200U // one byte is a 1-Wire bit slot
+#define DS18B20_CONVERT_MS 750U    // 12-bit conversion time
+#define DS18B20_READ_MS    10U     // scratchpad read takes ~3 ms, give up after this
+
+// LPUART BRR = 256 * fck / baud, rounded
+#define LPUART_BRR(clk, baud) ((uint32_t) (((uint64_t) (clk) * 256U + (baud) / 2U) / (baud)))
+#define LPUART_BRR_MIN        0x300U
+#define LPUART_BRR_MAX        0xFFFFFU
+
+void DS18B20_GPIO_Init (void);
+
+void DS18B20_TX_DMA_Init (void);
+void DS18B20_RX_DMA_Init (void);
+
+void DS18B20_LPUART1_Init (void);
+void DS18B20_LPUART1_Enable (void);
+
+uint8_t DS18B20_Busy (void);
+void DS18B20_CMDTransmit (const uint8_t * cmd, uint8_t size);
+void DS18B20_CMDReceive (const uint8_t * cmd, uint8_t size);
+
+PT_THREAD(DS18B20_Process (Pt* pt));
+
+#endif
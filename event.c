@@ -0,0 +1,73 @@
+#include "event.h"
+#include "stm32l476xx.h"
+#include <stdio.h>
+
+extern const char* STATUS2STR[];
+
+typedef struct {
+	uint8_t type;
+	int32_t value;
+} Event;
+
+// Ring buffer shared by the main loop and the console ISR
+static Event queue[EVENT_QUEUE_SIZE];
+static volatile uint32_t head, tail;
+static volatile uint32_t dropped;
+
+void Event_Post(EventType type, int32_t value) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (head - tail < EVENT_QUEUE_SIZE) {
+		queue[head & (EVENT_QUEUE_SIZE - 1)].type = type;
+		queue[head & (EVENT_QUEUE_SIZE - 1)].value = value;
+		head++;
+	} else {
+		dropped++; // keep the oldest events, they explain the newer ones
+	}
+	__set_PRIMASK(primask);
+}
+
+static void Event_Print(const Event* e) {
+	switch (e->type) {
+		case EVENT_STATE:
+			printf("!EVT STATE %s\n", STATUS2STR[e->value]);
+			break;
+		case EVENT_SETPOINT: // value in hundredths of a degree Fahrenheit
+			printf("!EVT TEMP %d.%02d\n", e->value / 100, e->value % 100);
+			break;
+		case EVENT_COOKTIME:
+			printf("!EVT TIME %d\n", e->value);
+			break;
+		case EVENT_TIMER_DONE:
+			printf("!EVT TIMER DONE\n");
+			break;
+		case EVENT_SENSOR:
+			printf("!EVT SENSOR %s\n", e->value ? "OK" : "LOST");
+			break;
+		case EVENT_RESUME:
+			printf("!EVT RESUME %s\n", STATUS2STR[e->value]);
+			break;
+		default:
+			break;
+	}
+}
+
+// Emit every queued event, called from thread context
+void Event_Flush(void) {
+	Event e;
+	uint32_t lost;
+
+	while (tail != head) {
+		e = queue[tail & (EVENT_QUEUE_SIZE - 1)];
+		tail++;
+		Event_Print(&e);
+	}
+
+	if (dropped != 0) {
+		__disable_irq();
+		lost = dropped;
+		dropped = 0;
+		__enable_irq();
+		printf("!EVT DROPPED %u\n", lost);
+	}
+}
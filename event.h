@@ -0,0 +1,28 @@
+#ifndef __STM32L476R_NUCLEO_EVENT_H
+#define __STM32L476R_NUCLEO_EVENT_H
+
+#include <stdint.h>
+
+// Asynchronous notifications pushed to the console, one line per event:
+//   !EVT STATE <name>        state machine transition
+//   !EVT TEMP <F>            cooking temperature changed
+//   !EVT TIME <minutes>      cooking time changed
+//   !EVT TIMER DONE          cook timer expired
+//   !EVT SENSOR LOST|OK      DS18B20 disappeared/reappeared
+//   !EVT RESUME <state>      restarted from the backup register checkpoint
+//   !EVT DROPPED <n>         queue overflowed, n events lost
+typedef enum {
+	EVENT_STATE,
+	EVENT_SETPOINT,
+	EVENT_COOKTIME,
+	EVENT_TIMER_DONE,
+	EVENT_SENSOR,
+	EVENT_RESUME
+} EventType;
+
+#define EVENT_QUEUE_SIZE 32 // must be a power of 2
+
+void Event_Post(EventType type, int32_t value);
+void Event_Flush(void);
+
+#endif
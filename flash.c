@@ -0,0 +1,111 @@
+#include "flash.h"
+
+#define FLASH_KEY1 0x45670123U
+#define FLASH_KEY2 0xCDEF89ABU
+#define FLASH_SR_ERRORS (FLASH_SR_OPERR | FLASH_SR_PROGERR | FLASH_SR_WRPERR | FLASH_SR_PGAERR | \
+                         FLASH_SR_SIZERR | FLASH_SR_PGSERR | FLASH_SR_MISERR | FLASH_SR_FASTERR)
+
+// Programs take ~90 us and are waited for. A page erase takes ~22 ms and
+// runs in the background, the FLASH interrupt reports the end of it.
+// The controller is unlocked only for the duration of an operation.
+// A program cut short by a reset can leave a double-word with a double ECC
+// error; reading it raises an NMI, which Flash_Read turns into an error.
+
+static volatile uint8_t erasing;
+static volatile uint8_t eccFault;
+static FlashCallback eraseDone;
+static void* eraseContext;
+
+void Flash_Init(void) {
+	NVIC_SetPriority(FLASH_IRQn, 3);
+	NVIC_EnableIRQ(FLASH_IRQn);
+}
+
+static void Flash_Unlock(void) {
+	if ((FLASH->CR & FLASH_CR_LOCK) == FLASH_CR_LOCK) {
+		FLASH->KEYR = FLASH_KEY1;
+		FLASH->KEYR = FLASH_KEY2;
+	}
+}
+
+// The data cache may hold the old contents of a page that was just written
+static void Flash_FlushDataCache(void) {
+	if ((FLASH->ACR & FLASH_ACR_DCEN) == 0) return;
+	FLASH->ACR &= ~FLASH_ACR_DCEN;
+	FLASH->ACR |= FLASH_ACR_DCRST;
+	FLASH->ACR &= ~FLASH_ACR_DCRST;
+	FLASH->ACR |= FLASH_ACR_DCEN;
+}
+
+uint8_t Flash_Busy(void) {
+	return erasing || (FLASH->SR & FLASH_SR_BSY) == FLASH_SR_BSY;
+}
+
+// Read an 8-byte aligned double-word. -1 if it fails the ECC check, the
+// words are garbage then.
+int8_t Flash_Read(uint32_t addr, uint32_t* lo, uint32_t* hi) {
+	eccFault = 0;
+	*lo = *(const volatile uint32_t*) addr;
+	*hi = *(const volatile uint32_t*) (addr + 4U);
+	__DSB();
+	__ISB(); // the NMI is taken before eccFault is looked at
+	return eccFault ? -1 : 0;
+}
+
+// Program an erased, 8-byte aligned double-word. -1 while an erase is
+// running or if the controller reports an error.
+int8_t Flash_Program(uint32_t addr, uint32_t lo, uint32_t hi) {
+	uint32_t sr;
+
+	if (Flash_Busy() || (addr & 7U) != 0) return -1;
+	Flash_Unlock();
+	FLASH->SR = FLASH_SR_ERRORS | FLASH_SR_EOP; // left over from an earlier operation
+	FLASH->CR |= FLASH_CR_PG;
+	*(volatile uint32_t*) addr = lo;
+	*(volatile uint32_t*) (addr + 4U) = hi; // the second word starts the program
+	while ((FLASH->SR & FLASH_SR_BSY) == FLASH_SR_BSY);
+	sr = FLASH->SR;
+	FLASH->SR = FLASH_SR_ERRORS | FLASH_SR_EOP;
+	FLASH->CR &= ~FLASH_CR_PG;
+	FLASH->CR |= FLASH_CR_LOCK;
+	Flash_FlushDataCache();
+	return (sr & FLASH_SR_ERRORS) != 0 ? -1 : 0;
+}
+
+// Start erasing a bank 2 page and return. done runs from the FLASH
+// interrupt with 0 or -1; the page must not be read until then.
+int8_t Flash_Erase(uint16_t page, FlashCallback done, void* context) {
+	if (Flash_Busy() || page >= FLASH_BANK2_PAGES) return -1;
+	eraseDone = done;
+	eraseContext = context;
+	erasing = 1;
+	Flash_Unlock();
+	FLASH->SR = FLASH_SR_ERRORS | FLASH_SR_EOP;
+	FLASH->CR = (FLASH->CR & ~(FLASH_CR_PG | FLASH_CR_PNB)) | FLASH_CR_PER | FLASH_CR_BKER |
+	            ((uint32_t) page << 3) | FLASH_CR_EOPIE | FLASH_CR_ERRIE;
+	FLASH->CR |= FLASH_CR_STRT;
+	return 0;
+}
+
+// ECCD is the only NMI source we can recover from: note it and let the
+// read in Flash_Read complete
+void NMI_Handler(void) {
+	if ((FLASH->ECCR & FLASH_ECCR_ECCD) == FLASH_ECCR_ECCD) {
+		FLASH->ECCR = (FLASH->ECCR & FLASH_ECCR_ECCIE) | FLASH_ECCR_ECCD; // ECCC is cleared by writing 1 too
+		eccFault = 1;
+		return;
+	}
+	for (;;); // clock security system or SRAM parity error
+}
+
+void FLASH_IRQHandler(void) {
+	uint32_t sr = FLASH->SR;
+
+	FLASH->SR = FLASH_SR_ERRORS | FLASH_SR_EOP;
+	FLASH->CR &= ~(FLASH_CR_PER | FLASH_CR_BKER | FLASH_CR_PNB | FLASH_CR_EOPIE | FLASH_CR_ERRIE);
+	FLASH->CR |= FLASH_CR_LOCK;
+	if (!erasing) return;
+	Flash_FlushDataCache();
+	erasing = 0;
+	if (eraseDone) eraseDone((sr & FLASH_SR_ERRORS) != 0 ? -1 : 0, eraseContext);
+}
@@ -0,0 +1,24 @@
+#ifndef __STM32L476R_NUCLEO_FLASH_H
+#define __STM32L476R_NUCLEO_FLASH_H
+
+#include <stdint.h>
+#include "stm32l476xx.h"
+
+// Internal flash: 1 MB in two banks of 256 pages of 2 KB. The code runs
+// from bank 1, data pages are taken from the top of bank 2 so programming
+// or erasing them does not stall instruction fetches (read-while-write).
+#define FLASH_PAGE_SIZE       2048U
+#define FLASH_BANK2_BASE      0x08080000U
+#define FLASH_BANK2_PAGES     256U
+#define FLASH_PAGE_ADDR(page) (FLASH_BANK2_BASE + (uint32_t) (page) * FLASH_PAGE_SIZE) // bank 2 page
+#define FLASH_ERASED          0xFFFFFFFFU
+
+typedef void (*FlashCallback)(int8_t status, void* context);
+
+void Flash_Init(void);
+int8_t Flash_Read(uint32_t addr, uint32_t* lo, uint32_t* hi);
+int8_t Flash_Program(uint32_t addr, uint32_t lo, uint32_t hi);
+int8_t Flash_Erase(uint16_t page, FlashCallback done, void* context);
+uint8_t Flash_Busy(void);
+
+#endif
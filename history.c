@@ -0,0 +1,346 @@
+#include "history.h"
+#include "flash.h"
+#include "settings.h"
+#include "SysClock.h"
+#include "RTC.h"
+#include "BLE.h"
+#include <stdio.h>
+#include <string.h>
+
+// A page is a header double-word {HISTORY_MAGIC, sequence}, then varint
+// tokens up to the first erased double-word:
+//   0            padding
+//   2            mark: varint seconds since 2000-01-01, varint zigzag
+//                temperature in 1/16 C (the DS18B20 resolution), state byte
+//   odd v        (v >> 1) + 1 samples equal to the last one
+//   even v >= 4  one sample, temperature changed by unzigzag((v >> 1) - 1)
+// Every token but padding is a sample, each a second after the one before
+// it. A mark starts each page, follows a missed second, a state change or
+// a reset, so no sample is ever made up.
+// Bytes are collected into double-words, queued and programmed from the
+// logger task; the next page is erased ahead so crossing into it does not
+// wait for an erase. A reset continues on a fresh page, the last
+// double-word of the old one may be torn and fail the ECC check; readers
+// treat it as the end of that page.
+
+#define HISTORY_TOKEN_PAD  0U
+#define HISTORY_TOKEN_MARK 2U
+#define HISTORY_SAMPLE_WORDS 4U // queue entries one sample can fill
+#define HISTORY_LINE_MAX   64U  // longest !LOG line
+#define HISTORY_NO_PAGE    0xFFFFU
+
+SYSCLOCK_STATIC_ASSERT(HISTORY_FIRST_PAGE + HISTORY_PAGES <= SETTINGS_PAGE_A, history_below_settings);
+
+typedef struct {
+	uint32_t addr;
+	uint32_t lo;
+	uint32_t hi;
+} HistoryWord;
+
+static HistoryWord queue[HISTORY_QUEUE];
+static uint32_t queueHead, queueTail;
+static uint8_t staged[8];   // double-word being filled
+static uint32_t cursor;     // flash address of the next byte
+static uint32_t pageEnd;    // end of the page cursor is in
+static uint32_t sequence;   // of the newest page with a header
+static uint16_t writePage = HISTORY_NO_PAGE;           // page with a header that the queue goes into
+static volatile uint16_t erasedPage = HISTORY_NO_PAGE; // erased and ready for a header
+static uint16_t erasing;
+
+static uint32_t run;        // unchanged samples not coded yet
+static uint32_t lastTime;   // of the last sample
+static int16_t lastTemp;
+static uint8_t lastState;
+static uint8_t needMark = 1;
+static uint32_t lastSync;
+static uint32_t lost;       // samples dropped on a full queue
+
+static uint32_t dumpSequence, dumpOffset;
+
+static uint16_t History_NextPage(uint16_t page) {
+	return HISTORY_FIRST_PAGE + (page - HISTORY_FIRST_PAGE + 1U) % HISTORY_PAGES;
+}
+
+// Nonzero if page is in use, its sequence number in seq
+static uint8_t History_Header(uint16_t page, uint32_t* seq) {
+	uint32_t magic;
+	if (Flash_Read(FLASH_PAGE_ADDR(page), &magic, seq) != 0) return 0;
+	return magic == HISTORY_MAGIC;
+}
+
+static uint16_t History_PageOf(uint32_t addr) {
+	return (addr - FLASH_BANK2_BASE) / FLASH_PAGE_SIZE;
+}
+
+// Seconds since 2000-01-01 from the RTC calendar
+static uint32_t History_Now(void) {
+	static const uint16_t DAYS_BEFORE[] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+	uint16_t year, again;
+	uint8_t month, day, dayAgain, hour, minute, second;
+	uint32_t days;
+
+	do { // midnight may pass between the date and the time
+		RTC_Get_Date(&year, &month, &day);
+		RTC_Get_Clock(&hour, &minute, &second);
+		RTC_Get_Date(&again, &month, &dayAgain);
+	} while (dayAgain != day);
+	year -= 2000U;
+	days = year * 365U + (year + 3U) / 4U + DAYS_BEFORE[month - 1] + day - 1U;
+	if (month > 2 && (year & 3U) == 0) days++;
+	return days * 86400U + hour * 3600U + minute * 60U + second;
+}
+
+//===============================================================================
+//                                 Encoder
+//===============================================================================
+static void History_Put(uint8_t b) {
+	HistoryWord* w;
+
+	staged[cursor & 7U] = b;
+	cursor++;
+	if ((cursor & 7U) != 0) return;
+	w = &queue[queueHead & (HISTORY_QUEUE - 1)];
+	w->addr = cursor - 8U;
+	w->lo = staged[0] | (staged[1] << 8) | (staged[2] << 16) | ((uint32_t) staged[3] << 24);
+	w->hi = staged[4] | (staged[5] << 8) | (staged[6] << 16) | ((uint32_t) staged[7] << 24);
+	queueHead++;
+}
+
+static void History_Align(void) {
+	while ((cursor & 7U) != 0) History_Put(HISTORY_TOKEN_PAD);
+}
+
+// Move to the next page unless n more bytes fit in this one, 0 if it moved
+static uint8_t History_Fits(uint8_t n) {
+	uint16_t page;
+
+	if (cursor + n <= pageEnd) return 1;
+	History_Align();
+	page = History_NextPage(History_PageOf(pageEnd - 1U));
+	cursor = FLASH_PAGE_ADDR(page) + 8U;
+	pageEnd = FLASH_PAGE_ADDR(page) + FLASH_PAGE_SIZE;
+	return 0;
+}
+
+static uint32_t History_Zigzag(int32_t v) {
+	return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+static uint8_t History_VarintSize(uint32_t v) {
+	uint8_t n = 1;
+	while (v >= 0x80U) {
+		v >>= 7;
+		n++;
+	}
+	return n;
+}
+
+static void History_Varint(uint32_t v) {
+	while (v >= 0x80U) {
+		History_Put((uint8_t) (v | 0x80U));
+		v >>= 7;
+	}
+	History_Put((uint8_t) v);
+}
+
+static void History_Mark(uint32_t time, int16_t temp, uint8_t state) {
+	History_Fits(2U + History_VarintSize(time) + History_VarintSize(History_Zigzag(temp)));
+	History_Put(HISTORY_TOKEN_MARK);
+	History_Varint(time);
+	History_Varint(History_Zigzag(temp));
+	History_Put(state);
+}
+
+// Code the pending run, which ends with the last sample
+static void History_FlushRun(void) {
+	uint32_t v;
+
+	if (run == 0) return;
+	v = ((run - 1U) << 1) | 1U;
+	if (!History_Fits(History_VarintSize(v))) { // new page: its first sample becomes the mark
+		History_Mark(lastTime - run + 1U, lastTemp, lastState);
+		if (--run == 0) return;
+		v = ((run - 1U) << 1) | 1U;
+	}
+	History_Varint(v);
+	run = 0;
+}
+
+// Record one sample, from the logger task about once a second
+void History_Sample(double celsius, uint8_t state) {
+	uint32_t now = History_Now();
+	int16_t temp = (int16_t) (celsius * 16 + (celsius < 0 ? -0.5 : 0.5));
+	uint32_t v;
+
+	if (!needMark && now == lastTime) return; // second run within the same RTC second
+	if (HISTORY_QUEUE - (queueHead - queueTail) < HISTORY_SAMPLE_WORDS) { // flash stuck, start over with a mark
+		lost++;
+		needMark = 1;
+		return;
+	}
+	if (!needMark && (state != lastState || now - lastTime != 1U)) needMark = 1;
+
+	if (needMark) {
+		History_FlushRun();
+		History_Mark(now, temp, state);
+		needMark = 0;
+		lastSync = now;
+	} else {
+		if (temp == lastTemp) {
+			lastTime = now;
+			if (++run >= HISTORY_RUN_MAX) History_FlushRun();
+		} else {
+			History_FlushRun();
+			v = (History_Zigzag(temp - lastTemp) + 1U) << 1;
+			if (History_Fits(History_VarintSize(v))) {
+				History_Varint(v);
+			} else {
+				History_Mark(now, temp, state);
+			}
+		}
+	}
+	lastTime = now;
+	lastTemp = temp;
+	lastState = state;
+	if (now - lastSync >= HISTORY_SYNC_S) History_Sync();
+}
+
+// Queue everything sampled so far: the pending run and a padded double-word
+void History_Sync(void) {
+	if (HISTORY_QUEUE - (queueHead - queueTail) < HISTORY_SAMPLE_WORDS) return;
+	History_FlushRun();
+	History_Align();
+	lastSync = lastTime;
+}
+
+//===============================================================================
+//                                 Writer
+//===============================================================================
+static void History_Erased(int8_t status, void* context) {
+	if (status == 0) erasedPage = erasing;
+}
+
+static void History_Erase(uint16_t page) {
+	erasing = page;
+	Flash_Erase(page, History_Erased, 0); // retried from the next poll if the flash is busy
+}
+
+// Pick up where the newest page left off, on a fresh page
+void History_Init(void) {
+	uint16_t page, newest = HISTORY_NO_PAGE;
+	uint32_t seq;
+
+	for (page = HISTORY_FIRST_PAGE; page < HISTORY_FIRST_PAGE + HISTORY_PAGES; page++) {
+		if (History_Header(page, &seq) && (newest == HISTORY_NO_PAGE || (int32_t) (seq - sequence) > 0)) {
+			newest = page;
+			sequence = seq;
+		}
+	}
+	page = newest == HISTORY_NO_PAGE ? HISTORY_FIRST_PAGE : History_NextPage(newest);
+	cursor = FLASH_PAGE_ADDR(page) + 8U;
+	pageEnd = FLASH_PAGE_ADDR(page) + FLASH_PAGE_SIZE;
+	writePage = HISTORY_NO_PAGE;
+	erasedPage = HISTORY_NO_PAGE;
+	queueTail = queueHead;
+	run = 0;
+	needMark = 1;
+}
+
+// Program the queued double-words, from the logger task
+void History_Poll(void) {
+	HistoryWord* w;
+	uint16_t page, next;
+
+	while (queueTail != queueHead) {
+		if (Flash_Busy()) return;
+		w = &queue[queueTail & (HISTORY_QUEUE - 1)];
+		page = History_PageOf(w->addr);
+		if (page != writePage) {
+			if (erasedPage != page) {
+				History_Erase(page);
+				return;
+			}
+			erasedPage = HISTORY_NO_PAGE;
+			if (Flash_Program(FLASH_PAGE_ADDR(page), HISTORY_MAGIC, sequence + 1U) != 0) return; // erased again next time
+			sequence++;
+			writePage = page;
+		}
+		Flash_Program(w->addr, w->lo, w->hi);
+		queueTail++;
+	}
+	if (writePage == HISTORY_NO_PAGE || Flash_Busy()) return;
+	next = History_NextPage(writePage);
+	if (erasedPage != next) History_Erase(next); // recycles the oldest page
+}
+
+//===============================================================================
+//                                 Download
+//===============================================================================
+// Page with the lowest sequence number from sequence on
+static uint16_t History_FindPage(uint32_t from) {
+	uint16_t page, found = HISTORY_NO_PAGE;
+	uint32_t seq, foundSequence = 0;
+
+	for (page = HISTORY_FIRST_PAGE; page < HISTORY_FIRST_PAGE + HISTORY_PAGES; page++) {
+		if (!History_Header(page, &seq) || (int32_t) (seq - from) < 0) continue;
+		if (found == HISTORY_NO_PAGE || (int32_t) (seq - foundSequence) < 0) {
+			found = page;
+			foundSequence = seq;
+		}
+	}
+	return found;
+}
+
+// Where History_Dump starts: the page with this sequence number (or the
+// oldest after it if it was recycled) at this byte offset
+void History_StartDump(uint32_t sequence, uint32_t offset) {
+	dumpSequence = sequence;
+	dumpOffset = offset;
+}
+
+// "!LOG <sequence> <offset> <hex>" per HISTORY_LINE_BYTES, then "!LOG END <lost>".
+// Waits for room in the BLE module instead of pacing inside printf, and
+// stays off bank 2 while it is being erased.
+PT_THREAD(History_Dump(Pt* pt)) {
+	static uint16_t page;
+	uint8_t data[HISTORY_LINE_BYTES + 8U];
+	uint32_t w[2];
+	uint32_t seq, n, i;
+
+	PT_BEGIN(pt);
+	for (;;) {
+		PT_WAIT_UNTIL(pt, !Flash_Busy());
+		page = History_FindPage(dumpSequence);
+		if (page == HISTORY_NO_PAGE) break;
+		History_Header(page, &seq);
+		if (seq != dumpSequence || dumpOffset < 8U) {
+			dumpSequence = seq;
+			dumpOffset = 8U;
+		}
+		while (dumpOffset < FLASH_PAGE_SIZE) {
+			PT_WAIT_UNTIL(pt, BLE_Room() >= HISTORY_LINE_MAX && !Flash_Busy());
+			if (!History_Header(page, &seq) || seq != dumpSequence) break; // recycled meanwhile
+
+			// up to the first erased or torn double-word
+			n = 0;
+			while (n < HISTORY_LINE_BYTES && dumpOffset + n < FLASH_PAGE_SIZE) {
+				i = (dumpOffset + n) & ~7U;
+				if (Flash_Read(FLASH_PAGE_ADDR(page) + i, &w[0], &w[1]) != 0) break;
+				if (w[0] == FLASH_ERASED && w[1] == FLASH_ERASED) break;
+				memcpy(data + n, (uint8_t*) w + (dumpOffset + n - i), i + 8U - dumpOffset - n);
+				n = i + 8U - dumpOffset;
+			}
+			if (n > HISTORY_LINE_BYTES) n = HISTORY_LINE_BYTES;
+			if (n == 0) break;
+
+			printf("!LOG %u %u ", dumpSequence, dumpOffset);
+			for (i = 0; i < n; i++) printf("%02X", data[i]);
+			printf("\n");
+			dumpOffset += n;
+		}
+		dumpSequence++;
+		dumpOffset = 8U;
+	}
+	printf("!LOG END %u\n", lost); // samples lost to a stuck flash
+	PT_END(pt);
+}
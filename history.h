@@ -0,0 +1,28 @@
+#ifndef __STM32L476R_NUCLEO_HISTORY_H
+#define __STM32L476R_NUCLEO_HISTORY_H
+
+#include <stdint.h>
+#include "pt.h"
+
+// Cook trace in flash for food safety records: one temperature sample a
+// second, delta coded so a 48 hour cook takes a few tens of KB. Samples go
+// into a ring of bank 2 pages, the oldest page is erased when the ring is
+// full. Every page starts with a mark (absolute time, temperature, state)
+// so it decodes on its own. DUMP sends the pages as !LOG hex lines,
+// tools/history_decode.py turns them into CSV.
+#define HISTORY_FIRST_PAGE 0U   // bank 2 page numbers, below the settings
+#define HISTORY_PAGES      64U  // 128 KB
+#define HISTORY_MAGIC      0x48535431U // "HST1", first word of a page in use
+#define HISTORY_SYNC_S     60U  // a sample reaches flash at most this late
+#define HISTORY_RUN_MAX    64U  // unchanged samples per one-byte run token
+#define HISTORY_QUEUE      32U  // double-words waiting for the flash, power of 2
+#define HISTORY_LINE_BYTES 16U  // data bytes per !LOG line
+
+void History_Init(void);
+void History_Sample(double celsius, uint8_t state);
+void History_Sync(void);
+void History_Poll(void);
+void History_StartDump(uint32_t sequence, uint32_t offset);
+PT_THREAD(History_Dump(Pt* pt));
+
+#endif
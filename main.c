@@ -1,271 +1,801 @@
-#include "stm32l476xx.h"
-#include "SysClock.h"
-#include "SysTimer.h"
-#include "UART.h"
-#include "ds18b20.h"
-#include "RTC.h"
-#include "alarm.h"
-#include "relay.h"
-#include "I2C.h"
-#include <stdio.h>
-#include <stdbool.h>
-#include <ctype.h>
-
-/* PIN LAYOUT
- * PC0/PC1 -> LPUART -> One-Wire DS18B20 Thermal Sensor
- * PB6/PB7 -> UART1 -> HM-10 Bluetooth LE UART UART
- * PB8/PB9 -> I2C1 -> LCD I2C 2004
- * PA13 -> IoT Relay/Pump
- */
-
-
-extern volatile double currentTemperature;
-extern volatile uint16_t minutes;
-
-static int tempHour, tempMinute, numOfArgs;
-static double tempTemp;
-
-static uint16_t cookingTime; // in minutes
-static double cookingTemperature; // in Celsius
-
-
-static const char* RELAY2STR[] = {"Off", "On"};
-static const char* STATUS2STR[] = {"Rest", "Warming", "Cooking", "Paused", "Finished"};
-static enum STATES {REST, WARMING, COOKING, PAUSED, FINISHED} status = REST;
-static enum COMMANDS {INVALID, REPORT, START, PAUSE, STOP, TIME, TEMP} command = INVALID;
-static char buffer[1024] = {0};
-static char lcd_buf[21] = {0};
-
-static const uint32_t windowSize = 5000U;
-static uint32_t lastTime, currentTime, windowStart, output;
-static double errSum, lastErr;
-static double kp = 2, ki = 5, kd = 1;
-
-void compute(void) {
-	uint32_t now = SysTick->VAL;
-	
-	double timeChange = (double) (now - lastTime);
-	
-	double error = cookingTemperature - currentTemperature;
-	errSum += (error * timeChange);
-	double dErr = (error - lastErr) / timeChange;
-	
-	output = kp * error + ki * errSum + kd*dErr;
-	lastErr = error;
-	lastTime = now;
-}
-
-int main(void)
-{
-	// Configure System Clock for 4MHz (with LSE calibration)
-	System_Clock_Init();
-	
-	// Initialize SysTick (no start)
-	SysTick_Init();
-	
-	// Initialize Console
-	UART1_Init();
-	UART1_GPIO_Init();
-	USART_Init(USART1);
-	NVIC_SetPriority(USART1_IRQn, 1);
-	NVIC_EnableIRQ(USART1_IRQn);
-	
-	
-	// Initialize RTC
-	RTC_Init();
-	RTC_Alarm_Enable();
-	RTC_Set_Alarm();
-	
-	// Initialize Relay
-	Relay_Init();
-	
-	// Make-sure NVIC Priority Grouping is 0 (16 priority levels, no sub-priority)
-	NVIC_SetPriorityGrouping((uint32_t) 0);
-	// Set Priority DMA2 Channel6 TC level (LPUART1_TX)
-	NVIC_SetPriority(DMA2_Channel6_IRQn, 1);
-	// Set Priority DMA2 Channel7 TC level (LPUART1_RX)
-	NVIC_SetPriority(DMA2_Channel7_IRQn, 1);
-	// Enable DMA2 Channel6 TC interrupt (LPUART1_TX)
-	NVIC_EnableIRQ(DMA2_Channel6_IRQn);
-	// Enable DMA2 Channel7 TC interrupt (LPUART1_RX)
-	NVIC_EnableIRQ(DMA2_Channel7_IRQn);
-	DS18B20_GPIO_Init();
-	DS18B20_LPUART1_Init();
-	DS18B20_TX_DMA_Init();
-	DS18B20_RX_DMA_Init();
-	DS18B20_LPUART1_Enable();
-	
-	// Initialize Screen
-	I2C_GPIO_Init();
-	I2C_Initialization();
-	LCD_Init();
-	LCD_Clear();
-	
-	// Infinite loop
-	while(1)
-	{
-		DS18B20_Process();
-		LCD_Locate(1, 1);
-		snprintf(lcd_buf, 21, "Status: %s                    ", STATUS2STR[status]);
-		LCD_print_str(lcd_buf);
-		
-		LCD_Locate(2, 1);
-		snprintf(lcd_buf, 21, "Temp: %.2f F                    ", currentTemperature * 9/5 + 32);
-		LCD_print_str(lcd_buf);
-		
-		LCD_Locate(3, 1);
-		snprintf(lcd_buf, 21, "Timer: %d Minutes                    ", cookingTime - minutes);
-		LCD_print_str(lcd_buf);
-		
-		LCD_Locate(4, 1);
-		snprintf(lcd_buf, 21, "Power: %s                    ", RELAY2STR[(GPIOA->ODR & GPIO_ODR_OD13) == GPIO_ODR_OD13]);
-		LCD_print_str(lcd_buf);
-		switch(status) {
-			case COOKING: // cook the food for cookingTime
-				if (command == PAUSE) {
-					command = INVALID; // clear command
-					status = PAUSED;
-					Alarm_Disable();
-					Relay_Off();
-				} else if (command == STOP) {
-					command = INVALID; // clear command
-					status = REST;
-					Alarm_Disable();
-					Relay_Off();
-					minutes = 0;
-				}else if (minutes < cookingTime) {
-					currentTime = SysTick->VAL;
-					compute();
-					if (output > currentTime - windowStart) { // time proportioning control
-						Relay_On();
-					} else {
-						Relay_Off();
-					}
-				} else {
-					Relay_Off();
-					Alarm_Disable();
-					status = FINISHED;
-				}
-				break;
-			case REST: // REST state before start cooking/warming
-				if (command == START) {
-					command = INVALID; // clear command
-					// start warming the water/check the water is at correct temp
-					status = WARMING;
-					Relay_On();
-				}
-				break;
-			case WARMING: // warm up water to cookingTemperature
-				if (command == PAUSE || command == STOP) {
-					command = INVALID; // clear command
-					status = REST; // off
-					Alarm_Disable();
-					Relay_Off();
-				} else if (currentTemperature >= cookingTemperature) {
-					status = COOKING; // start cooking, water reached desired temp
-					Alarm_Enable();
-				}
-				break;
-			case PAUSED: // pause cooking process temporarily
-				if (command == START) {
-					command = INVALID; // clear command
-					status = WARMING;
-					Relay_On();
-				} else if (command == STOP) {
-					command = INVALID; // clear command
-					status = REST;
-					minutes = 0;
-				}
-				break;
-			case FINISHED: // finished cooking, ping user and maintain temperature or shut off
-				if (command == START) {
-					command = INVALID; // clear command
-					status = WARMING;
-					Relay_On();
-				} else if (command == STOP) {
-					command = INVALID; // clear command
-					status = REST;
-					Relay_Off(); // should already be off but just in case
-				}
-				break;
-		}
-	}
-}
-
-enum COMMANDS getPrefix(void) {
-	if (strncmp(buffer, "REPORT", 5) == 0) {
-		return REPORT;
-	}
-	if (strncmp(buffer, "TEMP", 4) == 0) {
-		return TEMP;
-	}
-	if (strncmp(buffer, "TIME", 4) == 0) {
-		return TIME;
-	}
-	if (strncmp(buffer, "START", 5) == 0) {
-		return START;
-	}
-	if (strncmp(buffer, "STOP", 4) == 0) {
-		return STOP;
-	}
-	if (strncmp(buffer, "PAUSE", 5) == 0) {
-		return PAUSE;
-	}
-	return INVALID;
-}
-
-void USART1_IRQHandler(void) {
-	if (USART1->ISR & USART_ISR_RXNE) {
-		USART1->ISR &= ~USART_ISR_RXNE;
-		fgets(buffer, sizeof(buffer), stdin);
-		for (int i = 0; buffer[i] != '\0'; i++) {
-			buffer[i] = toupper(buffer[i]);
-		}
-		command = getPrefix();
-		switch (command) {
-			case TEMP:
-				sscanf(buffer + 4, "%lf", &tempTemp);
-				tempTemp = (tempTemp - 32) * 5 / 9; // convert to Celsius
-				if (tempTemp > 20 && tempTemp < 95) {
-					printf("SETTING TEMPERATURE TO %f F\n", tempTemp * 9/5 + 32);
-					cookingTemperature = tempTemp;
-				} else {
-					printf("INVALID TEMPERATURE\n");
-				}
-				break;
-			case TIME:
-				numOfArgs = sscanf(buffer + 4, "%u%u", &tempHour, &tempMinute);
-				switch(numOfArgs) {
-					case 2:
-						tempMinute += tempHour * 60;
-						break;
-					case 1:
-						tempMinute = tempHour;
-						break;
-					default:
-						tempMinute = 0;
-						break;
-				}
-				if (tempMinute > 0 && tempMinute < 2880) {// 48 hours
-					printf("SETTING COOK TIME TO %d MINUTES\n", tempMinute);
-					cookingTime = tempMinute;
-				} else {
-					printf("INVALID COOK TIME\n");
-				}
-				break;
-			case REPORT:
-				printf("SET TO %f C for %d MINUTES\n", cookingTemperature, cookingTime);
-				printf("CURRENT STATE: %s\n", STATUS2STR[status]);
-				if (status == COOKING || status == PAUSED) {
-					printf("CURRENT TEMPERATURE: %f, MINUTES ELAPSED: %d\n", currentTemperature, minutes);
-				}
-				break;
-			case INVALID:
-				printf("INVALID COMMAND\n");
-				break;
-			default:
-				printf("COMMAND ACKNOWLEDGED\n");
-				break;
-		}
-	}
-}
+#include "stm32l476xx.h"
+#include "SysClock.h"
+#include "SysTimer.h"
+#include "sched.h"
+#include "UART.h"
+#include "ds18b20.h"
+#include "RTC.h"
+#include "alarm.h"
+#include "relay.h"
+#include "I2C.h"
+#include "event.h"
+#include "BLE.h"
+#include "command.h"
+#include "console.h"
+#include "display.h"
+#include "trend.h"
+#include "checkpoint.h"
+#include "flash.h"
+#include "settings.h"
+#include "history.h"
+#include "boot.h"
+#include "power.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+/* PIN LAYOUT
+ * PC0/PC1 -> LPUART -> One-Wire DS18B20 Thermal Sensor
+ * PB6/PB7 -> UART1 -> HM-10 Bluetooth LE UART UART
+ * PB8/PB9 -> I2C1 -> LCD I2C 2004
+ * PA13 -> IoT Relay/Pump
+ */
+
+
+// Warm-up estimate for SCHEDULE FINISH, depends on the heater and the bath size
+#define WARMUP_C_PER_MINUTE 0.5
+
+// Task periods not set by their subsystem
+#define CONTROL_PERIOD_MS   100U
+#define CONSOLE_PERIOD_MS   50U
+#define TELEMETRY_PERIOD_MS 100U // posted events wait at most this long
+#define SENSOR_PERIOD_MS    10U // next measurement right after the last one is read
+
+extern volatile double currentTemperature;
+
+static uint16_t cookingTime; // in minutes
+static double cookingTemperature; // in Celsius
+
+
+static const char* RELAY2STR[] = {"Off", "On"};
+const char* STATUS2STR[] = {"Rest", "Warming", "Cooking", "Paused", "Finished", "Scheduled"};
+static enum STATES {REST, WARMING, COOKING, PAUSED, FINISHED, SCHEDULED} status = REST;
+static enum COMMANDS {INVALID, START, PAUSE, STOP, SCHEDULE} command = INVALID; // pending state machine request
+static uint16_t scheduleStart; // minute of the day heating starts, for SCHEDULE
+static uint32_t awakeSince;    // tick of the last wakeup or console line
+
+// Console lines are applied to a staged copy and committed only if every command succeeded
+static double stagedTemperature;
+static uint16_t stagedTime;
+static enum COMMANDS stagedCommand;
+static uint16_t stagedStart;
+static double stagedKp, stagedKi, stagedKd;
+static uint32_t stagedWindow;
+static uint8_t stagedRefresh;
+static uint8_t stagedDump;
+static uint32_t stagedDumpSequence, stagedDumpOffset;
+// Clock, date, profile and stats changes cannot be undone, they wait for the commit too
+static uint8_t stagedClock, stagedHour, stagedMinute, stagedSecond;
+static uint8_t stagedDate, stagedMonth, stagedDay;
+static uint16_t stagedYear;
+static uint8_t stagedProfile;
+static SysClockProfile stagedProfileTo;
+static uint8_t stagedTasksReset;
+static char line[CONSOLE_LINE_SIZE] = {0};
+static Pt sensorPt;
+static Pt consolePt;
+static Pt dumpPt;
+static Pt displayPt;
+static uint8_t refreshing;
+static uint8_t dumping;
+
+// Controller state as shown on the LCD, copied in one go so a row never
+// mixes values from before and after an interrupt
+typedef struct {
+	enum STATES status;
+	double temperature;
+	int32_t remaining; // seconds
+	uint8_t relay;
+} Snapshot;
+
+static uint32_t windowSize = 5000U;
+static uint32_t lastTime, currentTime, windowStart, output;
+static double errSum, lastErr;
+static double kp = 2, ki = 5, kd = 1;
+static uint8_t refreshRate = DISPLAY_RATE_DEFAULT;
+
+// Record the cook state in the backup registers, see resume()
+static void saveCheckpoint(void) {
+	Checkpoint cp;
+	cp.status = status;
+	cp.cookingTime = cookingTime;
+	cp.setpoint = cookingTemperature;
+	cp.integrator = errSum;
+	cp.elapsedTicks = CookTimer_Ticks();
+	Checkpoint_Save(&cp);
+	if (RTC_BAK_GetRegister(RTC_BKP_BAUD_REG) != BLE_GetBaud()) {
+		RTC_BAK_SetRegister(RTC_BKP_BAUD_REG, BLE_GetBaud()); // skips the baud probe on a warm boot
+	}
+}
+
+// change state and notify the connected client
+static void setStatus(enum STATES next) {
+	if (status != next) {
+		status = next;
+		Event_Post(EVENT_STATE, next);
+		Display_Activity();
+		saveCheckpoint();
+	}
+}
+
+void compute(void) {
+	uint32_t now = SysTick->VAL;
+	
+	double timeChange = (double) (now - lastTime);
+	
+	double error = cookingTemperature - currentTemperature;
+	errSum += (error * timeChange);
+	double dErr = (error - lastErr) / timeChange;
+	
+	output = kp * error + ki * errSum + kd*dErr;
+	lastErr = error;
+	lastTime = now;
+}
+
+static int8_t cmdTemp(int argc, const CommandArg* argv) {
+	double temp = (argv[0].f - 32) * 5 / 9; // convert to Celsius
+	if (temp > 20 && temp < 95) {
+		if (!Command_Checking()) Command_Reply("SETTING TEMPERATURE TO %f F\n", argv[0].f);
+		stagedTemperature = temp;
+		return COMMAND_OK;
+	}
+	Command_Reply("INVALID TEMPERATURE\n");
+	return COMMAND_REJECTED;
+}
+
+static int8_t cmdTime(int argc, const CommandArg* argv) {
+	int32_t time = argc == 2 ? argv[0].i * 60 + argv[1].i : argv[0].i;
+	if (time > 0 && time < 2880) {// 48 hours
+		if (!Command_Checking()) Command_Reply("SETTING COOK TIME TO %d MINUTES\n", time);
+		stagedTime = time;
+		return COMMAND_OK;
+	}
+	Command_Reply("INVALID COOK TIME\n");
+	return COMMAND_REJECTED;
+}
+
+static int8_t cmdReport(int argc, const CommandArg* argv) {
+	uint16_t year;
+	uint8_t month, day, hour, minute, second;
+	if (Command_Checking()) return COMMAND_OK;
+	RTC_Get_Date(&year, &month, &day);
+	RTC_Get_Clock(&hour, &minute, &second);
+	Command_Reply("CLOCK: %04u-%02u-%02u %02u:%02u:%02u\n", year, month, day, hour, minute, second);
+	Command_Reply("SET TO %f C for %d MINUTES\n", stagedTemperature, stagedTime);
+	Command_Reply("CURRENT STATE: %s\n", STATUS2STR[status]);
+	if (status == SCHEDULED) {
+		Alarm_B_Get(&hour, &minute);
+		Command_Reply("HEATING STARTS AT %02u:%02u\n", hour, minute);
+	}
+	if (status == COOKING || status == PAUSED) {
+		uint32_t elapsed = CookTimer_Elapsed();
+		Command_Reply("CURRENT TEMPERATURE: %f, ELAPSED: %u:%02u:%02u\n", currentTemperature,
+		              elapsed / 3600, elapsed / 60 % 60, elapsed % 60);
+	}
+	return COMMAND_OK;
+}
+
+static int8_t cmdStart(int argc, const CommandArg* argv) {
+	stagedCommand = START;
+	if (!Command_Checking()) Command_Reply("COMMAND ACKNOWLEDGED\n");
+	return COMMAND_OK;
+}
+
+static int8_t cmdPause(int argc, const CommandArg* argv) {
+	stagedCommand = PAUSE;
+	if (!Command_Checking()) Command_Reply("COMMAND ACKNOWLEDGED\n");
+	return COMMAND_OK;
+}
+
+static int8_t cmdStop(int argc, const CommandArg* argv) {
+	stagedCommand = STOP;
+	if (!Command_Checking()) Command_Reply("COMMAND ACKNOWLEDGED\n");
+	return COMMAND_OK;
+}
+
+// Takes effect immediately, a link change cannot be staged, so it has to
+// be the only command of its line
+static int8_t cmdBaud(int argc, const CommandArg* argv) {
+	if (!BLE_BaudValid(argv[0].i)) {
+		Command_Reply("INVALID BAUD RATE\n");
+		return COMMAND_REJECTED;
+	}
+	if (Command_Count() != 1) {
+		Command_Reply("BAUD MUST BE ALONE ON ITS LINE\n");
+		return COMMAND_REJECTED;
+	}
+	if (Command_Checking()) return COMMAND_OK;
+	Command_Reply("SETTING BAUD TO %d, SEND A COMMAND WITHIN %u S TO KEEP IT\n", argv[0].i, BLE_BAUD_CONFIRM_MS / 1000);
+	if (BLE_SetBaud(argv[0].i) != 0) {
+		Command_Reply("BAUD CHANGE FAILED\n");
+		return COMMAND_REJECTED;
+	}
+	return COMMAND_OK;
+}
+
+static int8_t cmdDiag(int argc, const CommandArg* argv) {
+	I2C_Stats i2c;
+	PowerStats power;
+	if (Command_Checking()) return COMMAND_OK;
+	I2C_GetStats(&i2c);
+	Command_Reply("I2C: %u TRANSACTIONS, %u NACK, %u BUS ERROR, %u ARB LOST, %u OVERRUN\n",
+	              i2c.transactions, i2c.nacks, i2c.busErrors, i2c.arbitrationLost, i2c.overruns);
+	Command_Reply("I2C: %u TIMEOUTS, %u BUS RECOVERIES\n", i2c.timeouts, i2c.recoveries);
+	Command_Reply("BLE: %u BYTES IN %u CHUNKS AT %u BAUD, %u DROPPED\n", BLE_GetBytes(), BLE_GetChunks(),
+	              BLE_GetBaud(), BLE_GetOverflows());
+	Power_GetStats(&power);
+	Command_Reply("POWER: RUN %u MS, SLEEP %u MS, STOP %u MS IN %u STOPS\n",
+	              power.runMs, power.sleepMs, power.stopMs, power.stops);
+	return COMMAND_OK;
+}
+
+static int8_t cmdRefresh(int argc, const CommandArg* argv) {
+	if (argv[0].i < 1 || argv[0].i > DISPLAY_RATE_MAX) {
+		Command_Reply("INVALID RATE, 1 TO %u HZ\n", DISPLAY_RATE_MAX);
+		return COMMAND_REJECTED;
+	}
+	stagedRefresh = argv[0].i;
+	if (Command_Checking()) return COMMAND_OK;
+	Command_Reply("LCD REFRESH SET TO %d HZ\n", argv[0].i);
+	return COMMAND_OK;
+}
+
+// DUMP [sequence offset]: stream the cook history as !LOG lines in the
+// background; after an interruption continue from the last line received
+static int8_t cmdDump(int argc, const CommandArg* argv) {
+	stagedDump = 1;
+	stagedDumpSequence = argc >= 1 ? argv[0].i : 0;
+	stagedDumpOffset = argc == 2 ? argv[1].i : 0;
+	return COMMAND_OK;
+}
+
+// TUNE <kp> <ki> <kd> [window ms]: PID gains, kept in flash
+static int8_t cmdTune(int argc, const CommandArg* argv) {
+	int32_t window = argc == 4 ? argv[3].i : (int32_t) stagedWindow;
+	if (argv[0].f < 0 || argv[1].f < 0 || argv[2].f < 0 || window < 1000 || window > 60000) {
+		Command_Reply("INVALID GAINS OR WINDOW\n");
+		return COMMAND_REJECTED;
+	}
+	stagedKp = argv[0].f;
+	stagedKi = argv[1].f;
+	stagedKd = argv[2].f;
+	stagedWindow = window;
+	if (Command_Checking()) return COMMAND_OK;
+	Command_Reply("KP %f KI %f KD %f WINDOW %u MS\n", stagedKp, stagedKi, stagedKd, stagedWindow);
+	return COMMAND_OK;
+}
+
+// CLOCK [IDLE|BURST]: show or switch the system clock profile
+static int8_t cmdClock(int argc, const CommandArg* argv) {
+	if (argc == 1 && strcmp(argv[0].s, "BURST") != 0 && strcmp(argv[0].s, "IDLE") != 0) {
+		Command_Reply("USE CLOCK IDLE OR CLOCK BURST\n");
+		return COMMAND_REJECTED;
+	}
+	if (argc == 1) { // switched at commit
+		stagedProfile = 1;
+		stagedProfileTo = strcmp(argv[0].s, "BURST") == 0 ? SYSCLOCK_BURST : SYSCLOCK_IDLE;
+	}
+	if (Command_Checking()) return COMMAND_OK;
+	if (argc == 1 && stagedProfileTo == SYSCLOCK_BURST) {
+		Command_Reply("SYSCLK %u HZ, PCLK1 %u HZ (BURST)\n", SYSCLOCK_BURST_HZ, SYSCLOCK_BURST_PCLK1_HZ);
+	} else if (argc == 1) {
+		Command_Reply("SYSCLK %u HZ, PCLK1 %u HZ (IDLE)\n", SYSCLOCK_IDLE_HZ, SYSCLOCK_IDLE_PCLK1_HZ);
+	} else {
+		Command_Reply("SYSCLK %u HZ, PCLK1 %u HZ (%s)\n", SysClock_GetFreq(), SysClock_GetPCLK1(),
+		              SysClock_GetProfile() == SYSCLOCK_BURST ? "BURST" : "IDLE");
+	}
+	return COMMAND_OK;
+}
+
+static int8_t cmdBoot(int argc, const CommandArg* argv) {
+	BootPhase phase;
+	if (Command_Checking()) return COMMAND_OK;
+	Command_Reply("%s BOOT\n", RTC_WarmBoot() ? "WARM" : "COLD");
+	for (phase = BOOT_START; phase < BOOT_PHASES; phase++) {
+		Command_Reply("%-8s %u US\n", Boot_Name(phase), Boot_Micros(phase));
+	}
+	return COMMAND_OK;
+}
+
+// TASKS [RESET]: run time per task since boot or the last reset, RESET
+// clears them once the line is committed
+static int8_t cmdTasks(int argc, const CommandArg* argv) {
+	TaskStats s;
+	uint8_t i;
+	if (argc == 1 && strcmp(argv[0].s, "RESET") == 0) {
+		stagedTasksReset = 1;
+	}
+	if (Command_Checking()) return COMMAND_OK;
+	for (i = 0; i < Sched_Count(); i++) {
+		Sched_GetStats(i, &s);
+		Command_Reply("%-9s %u RUNS, AVG %u US, MAX %u US, %u OVERRUNS, %u LATE\n", Sched_Name(i), s.runs,
+		              s.runs ? s.totalUs / s.runs : 0, s.maxUs, s.overruns, s.late);
+	}
+	return COMMAND_OK;
+}
+
+// SCHEDULE START|FINISH <hour> <minute>: start heating at a time of day, or
+// early enough to finish then. Works on the staged temperature and cook time,
+// so "TEMP 135; TIME 120; SCHEDULE FINISH 18 30" is one consistent request.
+static int8_t cmdSchedule(int argc, const CommandArg* argv) {
+	uint8_t hour, minute, second;
+	int32_t now, at, warmup, delay;
+
+	if (status != REST && status != FINISHED && status != SCHEDULED) {
+		Command_Reply("STOP COOKING FIRST\n");
+		return COMMAND_REJECTED;
+	}
+	if (argv[1].i < 0 || argv[1].i > 23 || argv[2].i < 0 || argv[2].i > 59) {
+		Command_Reply("INVALID TIME OF DAY\n");
+		return COMMAND_REJECTED;
+	}
+	RTC_Get_Clock(&hour, &minute, &second);
+	now = hour * 60 + minute;
+	at = argv[1].i * 60 + argv[2].i;
+	delay = (at - now + 1440) % 1440; // minutes until then, next occurrence
+
+	if (strcmp(argv[0].s, "FINISH") == 0) {
+		warmup = (int32_t) ((stagedTemperature - currentTemperature) / WARMUP_C_PER_MINUTE + 0.999);
+		if (warmup < 0) warmup = 0;
+		if (stagedTime + warmup > delay) {
+			Command_Reply("NOT ENOUGH TIME, NEEDS %d MINUTES\n", stagedTime + warmup);
+			return COMMAND_REJECTED;
+		}
+		delay -= stagedTime + warmup;
+		if (!Command_Checking()) Command_Reply("WARM-UP ESTIMATE %d MINUTES\n", warmup);
+	} else if (strcmp(argv[0].s, "START") != 0) {
+		Command_Reply("USE SCHEDULE START OR SCHEDULE FINISH\n");
+		return COMMAND_REJECTED;
+	}
+
+	if (delay == 0) { // the alarm matches at second 0, this minute has begun already
+		if (!Command_Checking()) Command_Reply("STARTING NOW\n");
+		stagedCommand = START;
+		return COMMAND_OK;
+	}
+	stagedStart = (now + delay) % 1440;
+	stagedCommand = SCHEDULE;
+	if (!Command_Checking()) Command_Reply("HEATING STARTS AT %02d:%02d\n", stagedStart / 60, stagedStart % 60);
+	return COMMAND_OK;
+}
+
+// The RTC is set at commit
+static int8_t cmdSetTime(int argc, const CommandArg* argv) {
+	int32_t second = argc == 3 ? argv[2].i : 0;
+	if (argv[0].i < 0 || argv[0].i > 23 || argv[1].i < 0 || argv[1].i > 59 || second < 0 || second > 59) {
+		Command_Reply("INVALID TIME\n");
+		return COMMAND_REJECTED;
+	}
+	stagedClock = 1;
+	stagedHour = argv[0].i;
+	stagedMinute = argv[1].i;
+	stagedSecond = second;
+	if (Command_Checking()) return COMMAND_OK;
+	Command_Reply("CLOCK SET TO %02d:%02d:%02d\n", argv[0].i, argv[1].i, second);
+	return COMMAND_OK;
+}
+
+static int8_t cmdSetDate(int argc, const CommandArg* argv) {
+	static const uint8_t DAYS[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	if (argv[0].i < 2000 || argv[0].i > 2099 || argv[1].i < 1 || argv[1].i > 12 ||
+	    argv[2].i < 1 || argv[2].i > DAYS[argv[1].i - 1] - (argv[1].i == 2 && argv[0].i % 4 != 0)) {
+		Command_Reply("INVALID DATE\n");
+		return COMMAND_REJECTED;
+	}
+	stagedDate = 1;
+	stagedYear = argv[0].i;
+	stagedMonth = argv[1].i;
+	stagedDay = argv[2].i;
+	if (Command_Checking()) return COMMAND_OK;
+	Command_Reply("DATE SET TO %04d-%02d-%02d\n", argv[0].i, argv[1].i, argv[2].i);
+	return COMMAND_OK;
+}
+
+// Console commands, HELP is added by the registry
+static const Command COMMAND_TABLE[] = {
+	{"TEMP",     "f",     cmdTemp,     "set cooking temperature in F"},
+	{"TIME",     "i|i",   cmdTime,     "set cook time, <minutes> or <hours> <minutes>"},
+	{"REPORT",   "",      cmdReport,   "show settings and progress"},
+	{"START",    "",      cmdStart,    "start or resume cooking"},
+	{"PAUSE",    "",      cmdPause,    "pause cooking"},
+	{"STOP",     "",      cmdStop,     "stop cooking and reset the timer"},
+	{"BAUD",     "i",     cmdBaud,     "change the Bluetooth link baud rate"},
+	{"DIAG",     "",      cmdDiag,     "show bus and link error counters"},
+	{"REFRESH",  "i",     cmdRefresh,  "set the LCD refresh rate in Hz"},
+	{"DUMP",     "|ii",   cmdDump,     "stream the temperature history, [sequence offset] resumes"},
+	{"TUNE",     "fff|i", cmdTune,     "set the PID gains, <kp> <ki> <kd> [window ms]"},
+	{"BOOT",     "",      cmdBoot,     "show boot phase timestamps"},
+	{"CLOCK",    "|w",    cmdClock,    "show or set the clock profile, IDLE or BURST"},
+	{"TASKS",    "|w",    cmdTasks,    "show task run times and overruns, RESET clears them"},
+	{"SCHEDULE", "wii",   cmdSchedule, "START or FINISH at <hour> <minute>, sleeps until then"},
+	{"SETTIME",  "ii|i",  cmdSetTime,  "set the clock, <hour> <minute> [second]"},
+	{"SETDATE",  "iii",   cmdSetDate,  "set the date, <year> <month> <day>"},
+};
+
+// Run one console line against the staged settings and commit them together
+static void processLine(char* str) {
+	int8_t result;
+
+	Display_Activity();
+	awakeSince = SysTick_GetTick();
+	stagedTemperature = cookingTemperature;
+	stagedTime = cookingTime;
+	stagedCommand = command;
+	stagedStart = scheduleStart;
+	stagedKp = kp;
+	stagedKi = ki;
+	stagedKd = kd;
+	stagedWindow = windowSize;
+	stagedRefresh = refreshRate;
+	stagedDump = 0;
+	stagedClock = 0;
+	stagedDate = 0;
+	stagedProfile = 0;
+	stagedTasksReset = 0;
+
+	// Confirm before running, so a BAUD line does not cancel its own revert
+	if (Command_Resolve(str) != COMMAND_INVALID) {
+		BLE_Confirm(); // client can talk to us, keep the current baud rate
+	}
+	result = Command_Execute();
+	if (result != COMMAND_OK) return;
+
+	if (stagedTemperature != cookingTemperature) {
+		cookingTemperature = stagedTemperature;
+		Event_Post(EVENT_SETPOINT, (int32_t) ((cookingTemperature * 9/5 + 32) * 100));
+		Settings_SetFloat(SETTING_TEMPERATURE, cookingTemperature);
+	}
+	if (stagedTime != cookingTime) {
+		cookingTime = stagedTime;
+		Event_Post(EVENT_COOKTIME, cookingTime);
+		Settings_Set(SETTING_TIME, cookingTime);
+	}
+	if (stagedKp != kp || stagedKi != ki || stagedKd != kd || stagedWindow != windowSize) {
+		kp = stagedKp;
+		ki = stagedKi;
+		kd = stagedKd;
+		windowSize = stagedWindow;
+		Settings_SetFloat(SETTING_KP, kp);
+		Settings_SetFloat(SETTING_KI, ki);
+		Settings_SetFloat(SETTING_KD, kd);
+		Settings_Set(SETTING_WINDOW, windowSize);
+	}
+	if (stagedRefresh != refreshRate) {
+		refreshRate = stagedRefresh;
+		Display_SetRate(refreshRate);
+		Settings_Set(SETTING_REFRESH, refreshRate);
+	}
+	if (stagedClock) {
+		CookTimer_Pause(); // the cook timer counts RTC time, keep the jump out of it
+		RTC_Set_Clock(stagedHour, stagedMinute, stagedSecond);
+		if (status == COOKING) CookTimer_Start();
+	}
+	if (stagedDate) RTC_Set_Date(stagedYear, stagedMonth, stagedDay);
+	if (stagedProfile) SysClock_SetProfile(stagedProfileTo);
+	if (stagedTasksReset) Sched_ResetStats();
+	command = stagedCommand;
+	scheduleStart = stagedStart;
+	saveCheckpoint();
+	if (stagedDump) { // streams after the line's OK
+		History_Sync();
+		History_Poll();
+		History_StartDump(stagedDumpSequence, stagedDumpOffset);
+		PT_INIT(&dumpPt);
+		dumping = 1;
+	}
+}
+
+// Tunables saved in flash, loaded before resume() so a checkpoint wins
+static void loadSettings(void) {
+	Settings_Init();
+	if (Settings_Has(SETTING_KP)) kp = Settings_GetFloat(SETTING_KP);
+	if (Settings_Has(SETTING_KI)) ki = Settings_GetFloat(SETTING_KI);
+	if (Settings_Has(SETTING_KD)) kd = Settings_GetFloat(SETTING_KD);
+	if (Settings_Has(SETTING_WINDOW)) windowSize = Settings_Get(SETTING_WINDOW);
+	if (Settings_Has(SETTING_TEMPERATURE)) cookingTemperature = Settings_GetFloat(SETTING_TEMPERATURE);
+	if (Settings_Has(SETTING_TIME)) cookingTime = Settings_Get(SETTING_TIME);
+	if (Settings_Has(SETTING_REFRESH) && Display_SetRate(Settings_Get(SETTING_REFRESH)) == 0) {
+		refreshRate = Settings_Get(SETTING_REFRESH);
+	}
+}
+
+// Continue a cook interrupted by a reset or brown-out. Runs right after the
+// RTC and relay are up, before the slow console and LCD initialization.
+static void resume(void) {
+	Checkpoint cp;
+
+	if (Checkpoint_Load(&cp) != 0 || cp.status > SCHEDULED) return;
+	cookingTemperature = cp.setpoint;
+	cookingTime = cp.cookingTime;
+	errSum = cp.integrator;
+	CookTimer_Restore(cp.elapsedTicks);
+	status = (enum STATES) cp.status;
+	if (status == COOKING) {
+		CookTimer_Start();
+	}
+	if (status == COOKING || status == WARMING) {
+		Relay_On(); // the control loop takes over on its first pass
+	}
+	Event_Post(EVENT_RESUME, status);
+}
+
+static void takeSnapshot(Snapshot* s) {
+	uint32_t primask;
+	s->remaining = (int32_t) cookingTime * 60 - (int32_t) CookTimer_Elapsed();
+	primask = __get_PRIMASK();
+	__disable_irq(); // temperature is written by the sensor DMA interrupt
+	s->status = status;
+	s->temperature = currentTemperature;
+	s->relay = (GPIOA->ODR & GPIO_ODR_OD13) == GPIO_ODR_OD13;
+	__set_PRIMASK(primask);
+}
+
+static void renderDisplay(void) {
+	Snapshot s;
+	char graph[TREND_COLUMNS + 1];
+	takeSnapshot(&s);
+	Trend_Render(graph);
+	Display_Printf(1, "%-9s Heat: %s", STATUS2STR[s.status], RELAY2STR[s.relay]);
+	Display_Printf(2, "Temp: %.2f F", s.temperature * 9/5 + 32);
+	if (s.remaining < 0) s.remaining = 0;
+	Display_Printf(3, "Timer: %d:%02d:%02d", s.remaining / 3600, s.remaining / 60 % 60, s.remaining % 60);
+	Display_Printf(4, "%s", graph); // last 10 minutes of temperature
+}
+
+//===============================================================================
+//                                 Tasks
+//===============================================================================
+// State machine and relay, the most urgent work
+static void taskControl(void) {
+	Boot_Mark(BOOT_CONTROL);
+	// Stop 2 costs the console its first character, only when nobody is typing and nothing is heating
+	Power_AllowStop((status == REST || status == FINISHED || status == SCHEDULED) &&
+	                SysTick_GetTick() - awakeSince >= POWER_AWAKE_MS);
+	switch(status) {
+		case COOKING: // cook the food for cookingTime
+			if (command == PAUSE) {
+				command = INVALID; // clear command
+				setStatus(PAUSED);
+				CookTimer_Pause();
+				Relay_Off();
+			} else if (command == STOP) {
+				command = INVALID; // clear command
+				setStatus(REST);
+				CookTimer_Reset();
+				Relay_Off();
+			}else if (CookTimer_Elapsed() < (uint32_t) cookingTime * 60) {
+				currentTime = SysTick_GetTick();
+				if (currentTime - windowStart >= windowSize) { // next window, keeping its phase
+					windowStart += (currentTime - windowStart) / windowSize * windowSize;
+				}
+				compute();
+				if (output > currentTime - windowStart) { // time proportioning control, on for output ms per window
+					Relay_On();
+				} else {
+					Relay_Off();
+				}
+			} else {
+				Relay_Off();
+				CookTimer_Pause();
+				Event_Post(EVENT_TIMER_DONE, 0);
+				setStatus(FINISHED);
+			}
+			break;
+		case REST: // REST state before start cooking/warming
+			if (command == START) {
+				command = INVALID; // clear command
+				// start warming the water/check the water is at correct temp
+				setStatus(WARMING);
+				Relay_On();
+			} else if (command == SCHEDULE) {
+				command = INVALID; // clear command
+				Alarm_B_Set(scheduleStart / 60, scheduleStart % 60);
+				setStatus(SCHEDULED);
+			}
+			break;
+		case WARMING: // warm up water to cookingTemperature
+			if (command == PAUSE || command == STOP) {
+				if (command == STOP) CookTimer_Reset();
+				command = INVALID; // clear command
+				setStatus(REST); // off
+				Relay_Off();
+			} else if (currentTemperature >= cookingTemperature) {
+				setStatus(COOKING); // start cooking, water reached desired temp
+				CookTimer_Start();
+			}
+			break;
+		case PAUSED: // pause cooking process temporarily
+			if (command == START) {
+				command = INVALID; // clear command
+				setStatus(WARMING);
+				Relay_On();
+			} else if (command == STOP) {
+				command = INVALID; // clear command
+				setStatus(REST);
+				CookTimer_Reset();
+			}
+			break;
+		case FINISHED: // finished cooking, ping user and maintain temperature or shut off
+			if (command == START) {
+				command = INVALID; // clear command
+				setStatus(WARMING);
+				CookTimer_Reset(); // a new cook
+				Relay_On();
+			} else if (command == STOP) {
+				command = INVALID; // clear command
+				setStatus(REST);
+				CookTimer_Reset();
+				Relay_Off(); // should already be off but just in case
+			} else if (command == SCHEDULE) {
+				command = INVALID; // clear command
+				CookTimer_Reset();
+				Alarm_B_Set(scheduleStart / 60, scheduleStart % 60);
+				setStatus(SCHEDULED);
+			}
+			break;
+		case SCHEDULED: // heater off until alarm B, the scheduler idles in Stop 2 most of the time
+			if (command == STOP) {
+				command = INVALID; // clear command
+				Alarm_B_Disable();
+				setStatus(REST);
+			} else if (command == SCHEDULE) {
+				command = INVALID; // clear command
+				Alarm_B_Set(scheduleStart / 60, scheduleStart % 60);
+			} else if (command == START || Alarm_B_Pending()) {
+				command = INVALID; // clear command
+				Alarm_B_Disable();
+				setStatus(WARMING);
+				Relay_On();
+			}
+			break;
+	}
+}
+
+// Resumes the measurement where it waited, when it can go on
+static void taskSensor(void) {
+	if (PT_SCHEDULE(DS18B20_Process(&sensorPt))) {
+		Sched_Delay(sensorPt.wait != 0 ? sensorPt.wait : 1U);
+	}
+}
+
+// Takes a line only once the link can carry the reply, so a burst of
+// commands waits here instead of inside printf
+static PT_THREAD(consoleThread(Pt* pt)) {
+	PT_BEGIN(pt);
+	for (;;) {
+		PT_WAIT_UNTIL(pt, Console_GetLine(line));
+		PT_WAIT_UNTIL(pt, BLE_Writable());
+		processLine(line);
+	}
+	PT_END(pt);
+}
+
+static void taskConsole(void) {
+	char tag[COMMAND_TAG_SIZE];
+	uint8_t why;
+
+	if (Power_ConsoleWake()) {
+		awakeSince = SysTick_GetTick();
+		printf("AWAKE, RESEND THE LAST COMMAND\n");
+	}
+	while (BLE_Writable() && (why = Console_GetRefused(tag)) != 0) {
+		if (tag[0] != '\0') printf("#%s ", tag);
+		printf("%s\n", why == CONSOLE_BUSY ? "BUSY" : "TOO LONG");
+	}
+	consoleThread(&consolePt);
+	if (dumping && !PT_SCHEDULE(History_Dump(&dumpPt))) {
+		dumping = 0;
+	}
+}
+
+// Events to the client, BLE flushes partial chunks on its own timer
+static void taskTelemetry(void) {
+	Event_Flush();
+}
+
+// Temperature history for the LCD and the flash log, the backup register
+// checkpoint and settings waiting for a flash page copy
+static void taskLogger(void) {
+	Trend_Sample(currentTemperature * 9/5 + 32);
+	if (status != REST && status != SCHEDULED) {
+		History_Sample(currentTemperature, status);
+	} else {
+		History_Sync(); // the end of the last cook reaches flash
+	}
+	History_Poll();
+	saveCheckpoint();
+	Settings_Poll();
+}
+
+// Lowest priority: only when due, after sensing and control. The refresh
+// yields while the I2C queue is full and finishes over later runs.
+static void taskDisplay(void) {
+	I2C_Poll();
+	if (!refreshing && Display_Due()) {
+		renderDisplay();
+		PT_INIT(&displayPt);
+		refreshing = 1;
+	}
+	if (refreshing) {
+		refreshing = PT_SCHEDULE(Display_Refresh(&displayPt));
+		if (refreshing) Sched_Delay(1);
+	}
+}
+
+static const Task TASK_TABLE[] = {
+	// name        function       period ms             deadline ms  priority
+	{"CONTROL",   taskControl,   CONTROL_PERIOD_MS,    20,          0},
+	{"SENSOR",    taskSensor,    SENSOR_PERIOD_MS,     20,          1},
+	{"CONSOLE",   taskConsole,   CONSOLE_PERIOD_MS,    200,         2},
+	{"TELEMETRY", taskTelemetry, TELEMETRY_PERIOD_MS,  50,          3},
+	{"LOGGER",    taskLogger,    CHECKPOINT_PERIOD_MS, 100,         4},
+	{"DISPLAY",   taskDisplay,   DISPLAY_POLL_MS,      200,         5},
+};
+
+int main(void)
+{
+	Boot_Init();
+	
+	// Configure System Clock for 4MHz (with LSE calibration)
+	System_Clock_Init();
+	Boot_Mark(BOOT_CLOCK);
+	
+	// Initialize SysTick (no start)
+	SysTick_Init();
+	
+	// Initialize RTC (calendar left running on a warm boot)
+	RTC_Init();
+	Boot_Mark(BOOT_RTC);
+	
+	// Initialize Relay
+	Relay_Init();
+	RTC_Alarm_Enable(); // alarm B may still be armed from before the reset
+	Power_Init();
+	Flash_Init();
+	loadSettings();
+	History_Init();
+	resume();
+	Boot_Mark(BOOT_RESUME);
+	
+	// Initialize Console
+	UART1_Init();
+	UART1_GPIO_Init();
+	USART_Init(USART1);
+	// HM-10 may have been left at another rate; after a warm boot it is the one we last used
+	if (!RTC_WarmBoot() || BLE_AssumeBaud(RTC_BAK_GetRegister(RTC_BKP_BAUD_REG)) != 0) {
+		BLE_DetectBaud();
+	}
+	Command_Init(COMMAND_TABLE, sizeof(COMMAND_TABLE) / sizeof(COMMAND_TABLE[0]));
+	NVIC_SetPriority(USART1_IRQn, 1);
+	NVIC_EnableIRQ(USART1_IRQn);
+	Boot_Mark(BOOT_CONSOLE);
+	
+	// Make-sure NVIC Priority Grouping is 0 (16 priority levels, no sub-priority)
+	NVIC_SetPriorityGrouping((uint32_t) 0);
+	// Set Priority DMA2 Channel6 TC level (LPUART1_TX)
+	NVIC_SetPriority(DMA2_Channel6_IRQn, 1);
+	// Set Priority DMA2 Channel7 TC level (LPUART1_RX)
+	NVIC_SetPriority(DMA2_Channel7_IRQn, 1);
+	// Enable DMA2 Channel6 TC interrupt (LPUART1_TX)
+	NVIC_EnableIRQ(DMA2_Channel6_IRQn);
+	// Enable DMA2 Channel7 TC interrupt (LPUART1_RX)
+	NVIC_EnableIRQ(DMA2_Channel7_IRQn);
+	DS18B20_GPIO_Init();
+	DS18B20_LPUART1_Init();
+	DS18B20_TX_DMA_Init();
+	DS18B20_RX_DMA_Init();
+	DS18B20_LPUART1_Enable();
+	Boot_Mark(BOOT_SENSOR);
+	
+	// Initialize Screen
+	I2C_GPIO_Init();
+	I2C_Initialization();
+	I2C_DMA_Init();
+	LCD_Init();
+	Display_Init();
+	Trend_Reset();
+	Boot_Mark(BOOT_DISPLAY);
+	
+	Sched_Init(TASK_TABLE, sizeof(TASK_TABLE) / sizeof(TASK_TABLE[0]));
+	Sched_Run();
+}
@@ -0,0 +1,159 @@
+#include "power.h"
+#include "SysTimer.h"
+#include "RTC.h"
+#include "I2C.h"
+#include "BLE.h"
+#include "SysClock.h"
+#include "softtimer.h"
+#include "flash.h"
+#include "ds18b20.h"
+
+// Sleep: WFI with every clock running, any interrupt wakes the core.
+// Stop 2: the core, SysTick and APB clocks stop, SRAM and the RTC keep
+// running. Wakeup sources are the RTC alarms (EXTI 18), the RTC wakeup
+// timer (EXTI 20) and a falling edge on PB7, the USART1 RX pin, so the
+// console can wake the controller. The character that wakes us is lost
+// because USART1 is not clocked in Stop 2.
+
+#define POWER_WUT_HZ 2048U // RTCCLK / 16
+
+static volatile uint8_t consoleWake;
+static uint8_t stopAllowed;
+static uint32_t sleepUs, sleepMs, stopMs, stops;
+static uint32_t stopRem; // ms * RTC_TICKS_PER_SECOND not yet given to SysTick
+
+void Power_Init(void) {
+	RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
+	
+	// PB7 on EXTI line 7, falling edge = start bit
+	SYSCFG->EXTICR[1] &= ~SYSCFG_EXTICR2_EXTI7;
+	SYSCFG->EXTICR[1] |= SYSCFG_EXTICR2_EXTI7_PB;
+	EXTI->RTSR1 &= ~EXTI_RTSR1_RT7;
+	EXTI->FTSR1 |= EXTI_FTSR1_FT7;
+	
+	// RTC wakeup timer on EXTI line 20, rising edge
+	EXTI->RTSR1 |= EXTI_RTSR1_RT20;
+	EXTI->IMR1 |= EXTI_IMR1_IM20;
+	
+	NVIC_SetPriority(EXTI9_5_IRQn, 1);
+	NVIC_EnableIRQ(EXTI9_5_IRQn);
+	NVIC_SetPriority(RTC_WKUP_IRQn, 1);
+	NVIC_EnableIRQ(RTC_WKUP_IRQn);
+}
+
+// WFI with residency accounting, see POWER_SLEEP_UNLESS
+void Power_Sleep(void) {
+	uint32_t start = SysTick_GetMicros();
+	__WFI();
+	sleepUs += SysTick_GetMicros() - start;
+	sleepMs += sleepUs / 1000U;
+	sleepUs %= 1000U;
+}
+
+static void Power_WakeupTimer(uint32_t ms) {
+	RTC_Disable_Write_Protection();
+	RTC->CR &= ~(RTC_CR_WUTE | RTC_CR_WUTIE);
+	while ((RTC->ISR & RTC_ISR_WUTWF) == 0);
+	RTC->ISR &= ~RTC_ISR_WUTF;
+	if (ms != 0) {
+		RTC->WUTR = ms * POWER_WUT_HZ / 1000U - 1U;
+		RTC->CR &= ~RTC_CR_WUCKSEL; // RTCCLK / 16
+		RTC->CR |= RTC_CR_WUTIE | RTC_CR_WUTE;
+	}
+	RTC_Enable_Write_Protection();
+}
+
+// Stop 2 for up to ms (0 = until an alarm or the console, at most 32 s
+// otherwise), cut short by the next software timer. SYSCLK comes back on
+// MSI (STOPWUCK = 0) at the MSIRANGE set before the stop, so the idle
+// profile is entered first and the previous one restored after.
+void Power_Stop2(uint32_t ms) {
+	uint32_t before, after;
+	uint32_t due = SoftTimer_NextDue();
+	SysClockProfile profile = SysClock_GetProfile();
+	
+	if (due < POWER_STOP_MIN_MS) return; // a callback is (nearly) due, not worth stopping
+	if (ms == 0 || ms > due) ms = due;
+	if (ms > 32000U) ms = 32000U;
+	SysClock_SetProfile(SYSCLOCK_IDLE);
+	BLE_Flush();
+	while ((USART1->ISR & USART_ISR_TC) == 0); // let the last console byte out
+	
+	EXTI->PR1 = EXTI_PR1_PIF7;
+	EXTI->IMR1 |= EXTI_IMR1_IM7; // only while asleep, not on every received byte
+	Power_WakeupTimer(ms);
+	
+	before = RTC_Get_Ticks();
+	RCC->APB1ENR1 |= RCC_APB1ENR1_PWREN;
+	PWR->CR1 = (PWR->CR1 & ~PWR_CR1_LPMS) | PWR_CR1_LPMS_STOP2;
+	SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+	__DSB();
+	__WFI();
+	SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+	
+	EXTI->IMR1 &= ~EXTI_IMR1_IM7;
+	Power_WakeupTimer(0);
+	
+	// the calendar shadow registers are stale until resynchronized
+	RTC_Disable_Write_Protection();
+	RTC->ISR &= ~RTC_ISR_RSF;
+	RTC_Enable_Write_Protection();
+	while ((RTC->ISR & RTC_ISR_RSF) == 0);
+	after = RTC_Get_Ticks();
+	
+	// carry the fraction of a millisecond so repeated stops do not lose time
+	stopRem += (after + RTC_TICKS_PER_DAY - before) % RTC_TICKS_PER_DAY * 1000U;
+	ms = stopRem / RTC_TICKS_PER_SECOND;
+	stopRem %= RTC_TICKS_PER_SECOND;
+	SysTick_Advance(ms);
+	stopMs += ms;
+	stops++;
+	SysClock_SetProfile(profile);
+}
+
+// Wait ms without work to do: in Stop 2 when the application allows it and
+// no I2C transfer, 1-Wire transfer or flash erase is running, in Sleep otherwise
+void Power_Idle(uint32_t ms) {
+	uint32_t start = SysTick_GetTick();
+	uint32_t spent;
+	
+	while ((spent = SysTick_GetTick() - start) < ms) {
+		if (stopAllowed && ms - spent >= POWER_STOP_MIN_MS && !I2C_Busy() && !Flash_Busy() && !DS18B20_Busy()) {
+			Power_Stop2(ms - spent);
+			if (consoleWake) stopAllowed = 0; // someone is typing, stay responsive
+		} else {
+			POWER_SLEEP_UNLESS(SysTick_GetTick() - start >= ms);
+		}
+	}
+}
+
+// Set by the application when a console character lost to a wakeup is acceptable
+void Power_AllowStop(uint8_t allow) {
+	stopAllowed = allow;
+}
+
+// Nonzero once after a Stop 2 that ended because of console activity
+uint8_t Power_ConsoleWake(void) {
+	uint8_t wake = consoleWake;
+	consoleWake = 0;
+	return wake;
+}
+
+void Power_GetStats(PowerStats* stats) {
+	stats->sleepMs = sleepMs;
+	stats->stopMs = stopMs;
+	stats->stops = stops;
+	stats->runMs = SysTick_GetTick() - sleepMs - stopMs;
+}
+
+void EXTI9_5_IRQHandler(void) {
+	if (EXTI->PR1 & EXTI_PR1_PIF7) {
+		EXTI->PR1 = EXTI_PR1_PIF7;
+		consoleWake = 1;
+	}
+}
+
+void RTC_WKUP_IRQHandler(void) {
+	RTC->ISR &= ~RTC_ISR_WUTF;
+	EXTI->PR1 = EXTI_PR1_PIF20;
+}
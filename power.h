@@ -0,0 +1,34 @@
+#ifndef __STM32L476R_NUCLEO_POWER_H
+#define __STM32L476R_NUCLEO_POWER_H
+
+#include <stdint.h>
+#include "stm32l476xx.h"
+
+#define POWER_AWAKE_MS    10000U // stay out of Stop 2 this long after a wakeup or console line
+#define POWER_STOP_MIN_MS 5U     // shorter idle periods are spent in Sleep
+
+typedef struct {
+	uint32_t runMs;    // core executing
+	uint32_t sleepMs;  // WFI, clocks running
+	uint32_t stopMs;   // Stop 2
+	uint32_t stops;    // Stop 2 entries
+} PowerStats;
+
+// Sleep until the next interrupt unless cond already holds. Interrupts are
+// masked between the test and the WFI, so an interrupt that makes cond true
+// in between still ends the sleep; its handler runs once they are unmasked.
+#define POWER_SLEEP_UNLESS(cond) do { \
+		__disable_irq();             \
+		if (!(cond)) Power_Sleep();  \
+		__enable_irq();              \
+	} while (0)
+
+void Power_Init(void);
+void Power_Sleep(void);
+void Power_Stop2(uint32_t ms);
+void Power_Idle(uint32_t ms);
+void Power_AllowStop(uint8_t allow);
+uint8_t Power_ConsoleWake(void);
+void Power_GetStats(PowerStats* stats);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __STM32L476R_NUCLEO_PT_H
+#define __STM32L476R_NUCLEO_PT_H
+
+#include <stdint.h>
+#include "SysTimer.h"
+
+// Protothreads: stackless coroutines in the style of Adam Dunkels' pt.h.
+// A thread is a function taking a Pt; PT_WAIT_UNTIL, PT_DELAY and
+// PT_YIELD return to the caller, and the next call resumes right after
+// them. The resume point is the source line, kept in a switch, so:
+//   - locals do not survive a wait, keep state in statics or the caller's data
+//   - no switch statements between PT_BEGIN and PT_END
+//   - waits only in the thread function itself, not in functions it calls
+//     (use PT_SPAWN to run a child thread)
+// Each thread costs the few bytes of its Pt instead of a stack.
+
+typedef struct {
+	uint16_t lc;    // line to resume at, 0 = start
+	uint32_t start; // tick PT_DELAY started at
+	uint32_t wait;  // ms until the thread can continue, 0 = unknown (poll)
+} Pt;
+
+#define PT_WAITING 0
+#define PT_YIELDED 1
+#define PT_EXITED  2
+#define PT_ENDED   3
+
+#define PT_THREAD(name_args) int8_t name_args
+
+#define PT_INIT(pt)  ((pt)->lc = 0)
+#define PT_BEGIN(pt) switch ((pt)->lc) { case 0:
+#define PT_END(pt)   } PT_INIT(pt); return PT_ENDED
+
+// Nonzero while the thread has not run to the end
+#define PT_SCHEDULE(f) ((f) < PT_EXITED)
+
+#define PT_WAIT_UNTIL(pt, cond) do {              \
+		(pt)->lc = __LINE__; case __LINE__:       \
+		if (!(cond)) {                            \
+			(pt)->wait = 0;                       \
+			return PT_WAITING;                    \
+		}                                         \
+	} while (0)
+
+#define PT_WAIT_WHILE(pt, cond) PT_WAIT_UNTIL(pt, !(cond))
+
+#define PT_DELAY(pt, ms) do {                                             \
+		(pt)->start = SysTick_GetTick();                                  \
+		(pt)->lc = __LINE__; case __LINE__:                               \
+		if (SysTick_GetTick() - (pt)->start < (ms)) {                     \
+			(pt)->wait = (ms) - (SysTick_GetTick() - (pt)->start);        \
+			return PT_WAITING;                                            \
+		}                                                                 \
+	} while (0)
+
+#define PT_YIELD(pt) do {                         \
+		(pt)->lc = __LINE__;                      \
+		(pt)->wait = 0;                           \
+		return PT_YIELDED;                        \
+		case __LINE__:;                           \
+	} while (0)
+
+// Run child to completion, waiting whenever it waits
+#define PT_SPAWN(pt, child, thread) do {          \
+		PT_INIT(child);                           \
+		(pt)->lc = __LINE__; case __LINE__:       \
+		if (PT_SCHEDULE(thread)) {                \
+			(pt)->wait = (child)->wait;           \
+			return PT_WAITING;                    \
+		}                                         \
+	} while (0)
+
+#define PT_EXIT(pt) do { PT_INIT(pt); return PT_EXITED; } while (0)
+
+#endif
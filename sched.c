@@ -0,0 +1,107 @@
+#include "sched.h"
+#include "SysTimer.h"
+#include "softtimer.h"
+#include "power.h"
+#include <string.h>
+
+static const Task* tasks;
+static uint8_t taskCount;
+static uint32_t release[SCHED_MAX_TASKS]; // tick of the next release
+static TaskStats stats[SCHED_MAX_TASKS];
+
+static uint32_t delayMs;
+static uint8_t delayed;
+
+void Sched_Init(const Task* table, uint8_t count) {
+	uint8_t i;
+	tasks = table;
+	taskCount = count > SCHED_MAX_TASKS ? SCHED_MAX_TASKS : count;
+	for (i = 0; i < taskCount; i++) {
+		release[i] = SysTick_GetTick(); // everything runs once right away
+	}
+	Sched_ResetStats();
+}
+
+// Next release of the running task ms from now instead of one period
+// after its last release, e.g. to come back when a conversion is done
+void Sched_Delay(uint32_t ms) {
+	delayMs = ms;
+	delayed = 1;
+}
+
+static void Sched_Execute(uint8_t id) {
+	TaskStats* s = &stats[id];
+	uint32_t start, elapsed, now;
+
+	delayed = 0;
+	start = SysTick_GetMicros();
+	tasks[id].run();
+	elapsed = SysTick_GetMicros() - start;
+
+	now = SysTick_GetTick();
+	s->runs++;
+	s->totalUs += elapsed;
+	if (elapsed > s->maxUs) s->maxUs = elapsed;
+	if (now - release[id] > tasks[id].deadline) s->overruns++;
+
+	if (delayed) {
+		release[id] = now + delayMs;
+	} else {
+		release[id] += tasks[id].period;
+		if ((int32_t) (release[id] - now) <= 0) { // fell a period behind, run again as soon as possible
+			s->late++;
+			release[id] = now;
+		}
+	}
+}
+
+// Never returns
+void Sched_Run(void) {
+	uint32_t now, wait, due;
+	int32_t until;
+	int8_t next;
+	uint8_t i;
+
+	for (;;) {
+		SoftTimer_Dispatch();
+		now = SysTick_GetTick();
+		next = -1;
+		wait = SCHED_IDLE_MAX_MS;
+		for (i = 0; i < taskCount; i++) {
+			until = (int32_t) (release[i] - now);
+			if (until > 0) {
+				if ((uint32_t) until < wait) wait = until;
+			} else if (next < 0 || tasks[i].priority < tasks[next].priority ||
+			           (tasks[i].priority == tasks[next].priority &&
+			            (int32_t) (release[i] + tasks[i].deadline - release[next] - tasks[next].deadline) < 0)) {
+				next = i;
+			}
+		}
+		if (next >= 0) {
+			Sched_Execute(next);
+			continue;
+		}
+		due = SoftTimer_NextDue();
+		if (due < wait) wait = due;
+		if (wait != 0) Power_Idle(wait);
+	}
+}
+
+uint8_t Sched_Count(void) {
+	return taskCount;
+}
+
+const char* Sched_Name(uint8_t id) {
+	return tasks[id].name;
+}
+
+void Sched_GetStats(uint8_t id, TaskStats* s) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	*s = stats[id];
+	__set_PRIMASK(primask);
+}
+
+void Sched_ResetStats(void) {
+	memset(stats, 0, sizeof(stats));
+}
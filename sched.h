@@ -0,0 +1,40 @@
+#ifndef __STM32L476R_NUCLEO_SCHED_H
+#define __STM32L476R_NUCLEO_SCHED_H
+
+#include <stdint.h>
+
+// Cooperative scheduler. Each task is released every period ms and must
+// return before its deadline; of the released tasks the one with the
+// lowest priority number runs first, ties go to the earlier deadline.
+// With nothing released the core idles (Sleep, or Stop 2 when allowed)
+// until the next release or software timer.
+#define SCHED_MAX_TASKS  8
+#define SCHED_IDLE_MAX_MS 1000U // longest idle without looking at the tasks again
+
+typedef void (*TaskFunction)(void);
+
+typedef struct {
+	const char* name;
+	TaskFunction run;
+	uint32_t period;   // ms between releases
+	uint32_t deadline; // ms after its release the run must have finished
+	uint8_t priority;  // 0 = most urgent
+} Task;
+
+typedef struct {
+	uint32_t runs;
+	uint32_t totalUs;  // time spent running, wraps after 71 minutes
+	uint32_t maxUs;
+	uint32_t overruns; // runs that finished after their deadline
+	uint32_t late;     // releases that came due again before the task ran
+} TaskStats;
+
+void Sched_Init(const Task* table, uint8_t count);
+void Sched_Run(void);
+void Sched_Delay(uint32_t ms);
+uint8_t Sched_Count(void);
+const char* Sched_Name(uint8_t id);
+void Sched_GetStats(uint8_t id, TaskStats* stats);
+void Sched_ResetStats(void);
+
+#endif
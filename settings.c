@@ -0,0 +1,166 @@
+#include "settings.h"
+#include "flash.h"
+#include "SysClock.h"
+
+// Page layout: a header double-word {SETTINGS_MAGIC, generation}, then
+// records {value, key << 24 | SETTINGS_TAG << 16 | CRC16} up to the first
+// erased double-word. The last record of a key wins. A copy gets its
+// header last, so a reset in the middle leaves a page without a header
+// that is ignored, and the old page stays valid until it is erased for
+// the next copy. Of two valid pages the higher generation is current.
+
+#define SETTINGS_TAG     0xA5U
+#define SETTINGS_NO_PAGE 0xFFFFU
+#define SETTINGS_RECORDS (FLASH_PAGE_SIZE / 8U - 1U)
+
+// A copy must leave room for at least one new record
+SYSCLOCK_STATIC_ASSERT(SETTINGS_COUNT < SETTINGS_RECORDS, settings_fit_in_a_page);
+
+typedef enum {
+	SETTINGS_READY,
+	SETTINGS_ERASING, // the other page, for a copy
+	SETTINGS_ERASED   // copy pending
+} SettingsState;
+
+typedef union {
+	float f;
+	uint32_t u;
+} Word;
+
+static uint32_t values[SETTINGS_COUNT];
+static uint32_t validMask; // keys with a value
+static uint32_t dirtyMask; // keys not in flash yet
+static uint16_t activePage = SETTINGS_NO_PAGE;
+static uint32_t generation;
+static uint32_t next; // first free double-word of the active page
+static volatile SettingsState state;
+
+// Low half of the CRC-32 (0x04C11DB7, init 0xFFFFFFFF) of the value and the key
+static uint16_t Settings_CRC(uint32_t value, uint32_t key) {
+	RCC->AHB1ENR |= RCC_AHB1ENR_CRCEN;
+	CRC->CR = CRC_CR_RESET;
+	CRC->DR = value;
+	CRC->DR = (key << 24) | (SETTINGS_TAG << 16);
+	return CRC->DR & 0xFFFFU;
+}
+
+static uint32_t Settings_Tag(uint32_t key, uint32_t value) {
+	return (key << 24) | (SETTINGS_TAG << 16) | Settings_CRC(value, key);
+}
+
+static uint16_t Settings_OtherPage(void) {
+	return activePage == SETTINGS_PAGE_A ? SETTINGS_PAGE_B : SETTINGS_PAGE_A;
+}
+
+static uint8_t Settings_Header(uint16_t page, uint32_t* gen) {
+	uint32_t magic;
+	if (Flash_Read(FLASH_PAGE_ADDR(page), &magic, gen) != 0) return 0;
+	return magic == SETTINGS_MAGIC;
+}
+
+// Load the current page into RAM
+void Settings_Init(void) {
+	uint32_t genA, genB, key, addr, value, tag;
+	uint8_t a = Settings_Header(SETTINGS_PAGE_A, &genA);
+	uint8_t b = Settings_Header(SETTINGS_PAGE_B, &genB);
+
+	if (a && (!b || (int32_t) (genA - genB) > 0)) {
+		activePage = SETTINGS_PAGE_A;
+		generation = genA;
+	} else if (b) {
+		activePage = SETTINGS_PAGE_B;
+		generation = genB;
+	} else {
+		return; // never written, the first Settings_Set starts page A
+	}
+
+	for (addr = FLASH_PAGE_ADDR(activePage) + 8U; addr < FLASH_PAGE_ADDR(activePage) + FLASH_PAGE_SIZE; addr += 8U) {
+		if (Flash_Read(addr, &value, &tag) != 0) continue; // torn by a reset, bad ECC
+		if (value == FLASH_ERASED && tag == FLASH_ERASED) break;
+		key = tag >> 24;
+		if (key < SETTINGS_COUNT && tag == Settings_Tag(key, value)) { // torn or foreign records are skipped
+			values[key] = value;
+			validMask |= 1UL << key;
+		}
+	}
+	next = addr;
+}
+
+uint8_t Settings_Has(SettingKey key) {
+	return key < SETTINGS_COUNT && (validMask & (1UL << key)) != 0;
+}
+
+// Only meaningful if Settings_Has(key)
+uint32_t Settings_Get(SettingKey key) {
+	return key < SETTINGS_COUNT ? values[key] : 0;
+}
+
+float Settings_GetFloat(SettingKey key) {
+	Word w;
+	w.u = Settings_Get(key);
+	return w.f;
+}
+
+// Takes effect in RAM at once; reaches flash now or, during a page copy,
+// from Settings_Poll. Writing the value already stored costs nothing.
+void Settings_Set(SettingKey key, uint32_t value) {
+	if (key >= SETTINGS_COUNT) return;
+	if ((validMask & (1UL << key)) != 0 && values[key] == value) return;
+	values[key] = value;
+	validMask |= 1UL << key;
+	dirtyMask |= 1UL << key;
+	Settings_Poll();
+}
+
+void Settings_SetFloat(SettingKey key, float value) {
+	Word w;
+	w.f = value;
+	Settings_Set(key, w.u);
+}
+
+static void Settings_Erased(int8_t status, void* context) {
+	state = status == 0 ? SETTINGS_ERASED : SETTINGS_READY; // a failed erase is retried
+}
+
+// Write every value into the freshly erased page, the header last
+static void Settings_Copy(void) {
+	uint16_t page = Settings_OtherPage();
+	uint32_t addr = FLASH_PAGE_ADDR(page) + 8U;
+	uint32_t key;
+
+	state = SETTINGS_READY;
+	for (key = 0; key < SETTINGS_COUNT; key++) {
+		if ((validMask & (1UL << key)) == 0) continue;
+		if (Flash_Program(addr, values[key], Settings_Tag(key, values[key])) != 0) return;
+		addr += 8U;
+	}
+	if (Flash_Program(FLASH_PAGE_ADDR(page), SETTINGS_MAGIC, generation + 1U) != 0) return;
+	activePage = page;
+	generation++;
+	next = addr;
+	dirtyMask = 0;
+}
+
+// Write pending values; called from a task so a copy interrupted by a busy
+// flash or a full page gets finished
+void Settings_Poll(void) {
+	uint32_t key;
+
+	if (state == SETTINGS_ERASING || Flash_Busy()) return;
+	if (state == SETTINGS_ERASED) {
+		Settings_Copy();
+		return;
+	}
+	for (key = 0; key < SETTINGS_COUNT && dirtyMask != 0; key++) {
+		if ((dirtyMask & (1UL << key)) == 0) continue;
+		if (activePage == SETTINGS_NO_PAGE || next >= FLASH_PAGE_ADDR(activePage) + FLASH_PAGE_SIZE) {
+			state = SETTINGS_ERASING;
+			if (Flash_Erase(Settings_OtherPage(), Settings_Erased, 0) != 0) state = SETTINGS_READY;
+			return;
+		}
+		if (Flash_Program(next, values[key], Settings_Tag(key, values[key])) == 0) {
+			dirtyMask &= ~(1UL << key);
+		}
+		next += 8U; // a failed program leaves the slot unusable
+	}
+}
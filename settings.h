@@ -0,0 +1,34 @@
+#ifndef __STM32L476R_NUCLEO_SETTINGS_H
+#define __STM32L476R_NUCLEO_SETTINGS_H
+
+#include <stdint.h>
+
+// Tunables kept in flash across power cycles, as a log of double-word
+// records (value, then key and CRC) in two bank 2 pages. A new value is
+// appended to the active page; when that is full the other page is erased
+// in the background and the current values are copied into it. Reads come
+// from a RAM copy built at boot.
+#define SETTINGS_PAGE_A 254U // bank 2 page numbers
+#define SETTINGS_PAGE_B 255U
+#define SETTINGS_MAGIC  0x53455431U // "SET1", first word of a page in use
+
+typedef enum {
+	SETTING_KP,
+	SETTING_KI,
+	SETTING_KD,
+	SETTING_WINDOW,      // relay window, ms
+	SETTING_TEMPERATURE, // setpoint, Celsius
+	SETTING_TIME,        // cook time, minutes
+	SETTING_REFRESH,     // LCD refresh rate, Hz
+	SETTINGS_COUNT
+} SettingKey;
+
+void Settings_Init(void);
+uint8_t Settings_Has(SettingKey key);
+uint32_t Settings_Get(SettingKey key);
+float Settings_GetFloat(SettingKey key);
+void Settings_Set(SettingKey key, uint32_t value);
+void Settings_SetFloat(SettingKey key, float value);
+void Settings_Poll(void);
+
+#endif
@@ -0,0 +1,219 @@
+#include "softtimer.h"
+#include "stm32l476xx.h"
+
+// Level n slot i holds the timers whose expiry, shifted right by 6n bits,
+// ends in i and that are due within 64 slots of level n. When the tick
+// crosses a level n slot boundary, that slot is cascaded: its timers are
+// placed again and land one level down. Level 0 timers are due exactly at
+// their slot and move to the expired list, which SoftTimer_Dispatch runs.
+// The wheel is shared with the SysTick interrupt, every change to it is
+// made with interrupts disabled.
+
+static SoftTimerNode wheel[SOFTTIMER_LEVELS][SOFTTIMER_SLOTS];
+static SoftTimerNode expired;
+static uint32_t now;   // ticks the wheel has processed
+static uint32_t armed; // timers in the wheel
+
+static void SoftTimer_ListInit(SoftTimerNode* head) {
+	head->next = head;
+	head->prev = head;
+}
+
+static void SoftTimer_Append(SoftTimerNode* head, SoftTimerNode* node) {
+	node->prev = head->prev;
+	node->next = head;
+	head->prev->next = node;
+	head->prev = node;
+}
+
+static void SoftTimer_Unlink(SoftTimerNode* node) {
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+}
+
+// Move every timer of head to out, out must be empty
+static void SoftTimer_Take(SoftTimerNode* head, SoftTimerNode* out) {
+	if (head->next == head) return;
+	out->next = head->next;
+	out->prev = head->prev;
+	out->next->prev = out;
+	out->prev->next = out;
+	SoftTimer_ListInit(head);
+}
+
+static void SoftTimer_Place(SoftTimer* t) {
+	uint32_t delta = t->expires - now;
+	uint8_t level = 0;
+
+	if (delta == 0 || delta > SOFTTIMER_MAX_MS) { // due, or overdue after a catch-up
+		t->state = SOFTTIMER_EXPIRED;
+		SoftTimer_Append(&expired, &t->node);
+		return;
+	}
+	while (level < SOFTTIMER_LEVELS - 1 && (delta >> (SOFTTIMER_SLOT_BITS * (level + 1))) != 0) {
+		level++;
+	}
+	t->state = SOFTTIMER_ARMED;
+	SoftTimer_Append(&wheel[level][(t->expires >> (SOFTTIMER_SLOT_BITS * level)) & (SOFTTIMER_SLOTS - 1)], &t->node);
+	armed++;
+}
+
+// Place every timer of a detached slot again
+static void SoftTimer_Cascade(SoftTimerNode* slot) {
+	SoftTimerNode list, *node, *next;
+
+	SoftTimer_ListInit(&list);
+	SoftTimer_Take(slot, &list);
+	for (node = list.next; node != &list; node = next) {
+		next = node->next;
+		armed--;
+		SoftTimer_Place((SoftTimer*) node);
+	}
+}
+
+// Called from SysTick_Init, before the first tick
+void SoftTimer_Init(void) {
+	uint8_t level, slot;
+	for (level = 0; level < SOFTTIMER_LEVELS; level++) {
+		for (slot = 0; slot < SOFTTIMER_SLOTS; slot++) {
+			SoftTimer_ListInit(&wheel[level][slot]);
+		}
+	}
+	SoftTimer_ListInit(&expired);
+}
+
+static void SoftTimer_Detach(SoftTimer* t) {
+	if (t->state == SOFTTIMER_ARMED) armed--;
+	if (t->state != SOFTTIMER_IDLE) SoftTimer_Unlink(&t->node);
+	t->state = SOFTTIMER_IDLE;
+}
+
+// (Re)start t to fire in ms, then every period ms unless period is 0.
+// ms = 0 runs the callback at the next SoftTimer_Dispatch.
+void SoftTimer_Start(SoftTimer* t, uint32_t ms, uint32_t period, SoftTimerCallback callback, void* context) {
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	SoftTimer_Detach(t);
+	t->expires = now + (ms > SOFTTIMER_MAX_MS ? SOFTTIMER_MAX_MS : ms);
+	t->period = period > SOFTTIMER_MAX_MS ? SOFTTIMER_MAX_MS : period;
+	t->callback = callback;
+	t->context = context;
+	SoftTimer_Place(t);
+	__set_PRIMASK(primask);
+}
+
+void SoftTimer_Stop(SoftTimer* t) {
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	SoftTimer_Detach(t);
+	__set_PRIMASK(primask);
+}
+
+// Milliseconds until the next timer may be due: exact for the next 64 ms,
+// the next cascade beyond that. 0 if callbacks are waiting, SOFTTIMER_NONE
+// if nothing is armed. Lets Stop 2 wake up in time.
+uint32_t SoftTimer_NextDue(void) {
+	uint32_t due = SOFTTIMER_NONE, at;
+	uint32_t primask = __get_PRIMASK();
+	uint8_t level, shift;
+	uint16_t i;
+
+	__disable_irq();
+	if (expired.next != &expired) {
+		due = 0;
+	} else if (armed != 0) {
+		for (level = 0; level < SOFTTIMER_LEVELS; level++) {
+			shift = SOFTTIMER_SLOT_BITS * level;
+			for (i = 1; i <= SOFTTIMER_SLOTS; i++) {
+				at = (now >> shift) + i;
+				if (wheel[level][at & (SOFTTIMER_SLOTS - 1)].next != &wheel[level][at & (SOFTTIMER_SLOTS - 1)]) {
+					if ((at << shift) - now < due) due = (at << shift) - now;
+					break;
+				}
+			}
+		}
+	}
+	__set_PRIMASK(primask);
+	return due;
+}
+
+// One millisecond, from SysTick_Handler. Higher levels cascade first so
+// their timers can still reach the level 0 slot that is due now.
+void SoftTimer_Tick(void) {
+	SoftTimerNode list, *node, *next;
+	uint8_t level = 1;
+
+	now++;
+	while (level < SOFTTIMER_LEVELS && (now & ((1UL << (SOFTTIMER_SLOT_BITS * level)) - 1U)) == 0) {
+		level++;
+	}
+	while (--level > 0) {
+		SoftTimer_Cascade(&wheel[level][(now >> (SOFTTIMER_SLOT_BITS * level)) & (SOFTTIMER_SLOTS - 1)]);
+	}
+
+	SoftTimer_ListInit(&list);
+	SoftTimer_Take(&wheel[0][now & (SOFTTIMER_SLOTS - 1)], &list);
+	for (node = list.next; node != &list; node = next) {
+		next = node->next;
+		armed--;
+		((SoftTimer*) node)->state = SOFTTIMER_EXPIRED;
+		SoftTimer_Append(&expired, node);
+	}
+}
+
+// Catch up with time SysTick did not count (Stop 2), interrupts disabled.
+// Short gaps are ticked through, longer ones place every timer once.
+void SoftTimer_Advance(uint32_t ms) {
+	SoftTimerNode list, *node, *next;
+	uint8_t level, slot;
+
+	if (ms <= SOFTTIMER_SLOTS && armed != 0) {
+		while (ms--) SoftTimer_Tick();
+		return;
+	}
+	SoftTimer_ListInit(&list);
+	for (level = 0; level < SOFTTIMER_LEVELS; level++) {
+		for (slot = 0; slot < SOFTTIMER_SLOTS; slot++) {
+			for (node = wheel[level][slot].next; node != &wheel[level][slot]; node = next) {
+				next = node->next;
+				SoftTimer_Append(&list, node);
+			}
+			SoftTimer_ListInit(&wheel[level][slot]);
+		}
+	}
+	now += ms;
+	for (node = list.next; node != &list; node = next) {
+		next = node->next;
+		armed--;
+		SoftTimer_Place((SoftTimer*) node); // overdue timers expire now
+	}
+}
+
+// Run the callbacks of expired timers, from the main loop. Periodic timers
+// are rearmed first, from their due time so the period does not drift.
+void SoftTimer_Dispatch(void) {
+	SoftTimer* t;
+	SoftTimerCallback callback;
+	void* context;
+	uint32_t primask = __get_PRIMASK();
+
+	for (;;) {
+		__disable_irq();
+		if (expired.next == &expired) break;
+		t = (SoftTimer*) expired.next;
+		SoftTimer_Unlink(&t->node);
+		t->state = SOFTTIMER_IDLE;
+		callback = t->callback;
+		context = t->context;
+		if (t->period != 0) {
+			t->expires += t->period;
+			if ((int32_t) (t->expires - now) <= 0) t->expires = now + t->period; // missed periods are skipped
+			SoftTimer_Place(t);
+		}
+		__set_PRIMASK(primask);
+		callback(context);
+	}
+	__set_PRIMASK(primask);
+}
@@ -0,0 +1,47 @@
+#ifndef __STM32L476R_NUCLEO_SOFTTIMER_H
+#define __STM32L476R_NUCLEO_SOFTTIMER_H
+
+#include <stdint.h>
+
+// Millisecond software timers driven by SysTick. Timers live in a four
+// level hierarchical timing wheel of 64 slots each (1 ms, 64 ms, 4 s and
+// 262 s per slot), so start and stop are O(1) and a tick only touches the
+// slot that is due. Callbacks run in thread context from SoftTimer_Dispatch.
+#define SOFTTIMER_SLOT_BITS 6
+#define SOFTTIMER_SLOTS     (1U << SOFTTIMER_SLOT_BITS)
+#define SOFTTIMER_LEVELS    4
+#define SOFTTIMER_MAX_MS    ((1UL << (SOFTTIMER_SLOT_BITS * SOFTTIMER_LEVELS)) - 1U) // 4.6 hours, longer is the RTC alarm's job
+#define SOFTTIMER_NONE      0xFFFFFFFFU // SoftTimer_NextDue with nothing armed
+
+typedef void (*SoftTimerCallback)(void* context);
+
+typedef struct SoftTimerNode {
+	struct SoftTimerNode* next;
+	struct SoftTimerNode* prev;
+} SoftTimerNode;
+
+typedef enum {
+	SOFTTIMER_IDLE,
+	SOFTTIMER_ARMED,  // in the wheel
+	SOFTTIMER_EXPIRED // waiting for SoftTimer_Dispatch
+} SoftTimerState;
+
+// Owned by the caller, usually static; must stay valid while armed
+typedef struct {
+	SoftTimerNode node; // first, a node pointer is a timer pointer
+	uint32_t expires;   // tick it is due at
+	uint32_t period;    // 0 = one-shot
+	SoftTimerCallback callback;
+	void* context;
+	volatile uint8_t state;
+} SoftTimer;
+
+void SoftTimer_Init(void);
+void SoftTimer_Start(SoftTimer* t, uint32_t ms, uint32_t period, SoftTimerCallback callback, void* context);
+void SoftTimer_Stop(SoftTimer* t);
+uint32_t SoftTimer_NextDue(void);
+void SoftTimer_Tick(void);
+void SoftTimer_Advance(uint32_t ms);
+void SoftTimer_Dispatch(void);
+
+#endif
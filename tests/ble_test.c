@@ -0,0 +1,234 @@
+// Host test of the BLE output stage (BLE.c) against a simulated HM-10.
+// The module takes bytes from the UART into a buffer of limited size and
+// sends up to BLE_MTU of them as one notification per connection event.
+// Checks that nothing is dropped or reordered, that interrupt output does
+// not split a chunk, and measures how full the notifications are.
+#include "BLE.h"
+#include "UART.h"
+#include "softtimer.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define MODULE_CAPACITY BLE_MODULE_BUFFER
+#define UART_MS_PER_BYTE 1U                            // 9600 baud
+
+static uint32_t now;
+static uint32_t phase; // of the connection events
+static uint32_t ipsr;
+
+static char module[MODULE_CAPACITY];
+static uint32_t moduleLen, moduleLost;
+static char air[65536]; // what reached the phone
+static uint32_t airLen, notifications;
+
+static const char* isrText;     // printed from an "interrupt" in the middle of a UART write
+static char writes[64][BLE_MTU + 1];
+static uint32_t writeCount;
+
+static void Module_Tick(void) {
+	uint32_t n;
+	now++;
+	if (now % BLE_CONN_INTERVAL_MS != phase || moduleLen == 0) return;
+	n = moduleLen < BLE_MTU ? moduleLen : BLE_MTU;
+	memcpy(air + airLen, module, n);
+	airLen += n;
+	memmove(module, module + n, moduleLen - n);
+	moduleLen -= n;
+	notifications++;
+}
+
+// Firmware dependencies
+uint32_t SysTick_GetTick(void) { return now; }
+void Power_Sleep(void) { Module_Tick(); }
+uint32_t __get_PRIMASK(void) { return 0; }
+void __set_PRIMASK(uint32_t primask) { (void) primask; }
+void __disable_irq(void) { }
+void __enable_irq(void) { }
+uint32_t __get_IPSR(void) { return ipsr; }
+void NVIC_EnableIRQ(IRQn_Type irq) { (void) irq; }
+void NVIC_DisableIRQ(IRQn_Type irq) { (void) irq; }
+void USART_SetBaud(USART_TypeDef* USARTx, uint32_t baud) { (void) USARTx; (void) baud; }
+uint8_t USART_BaudSupported(uint32_t baud) { return baud != 0 && baud <= USART_BAUD_MAX; }
+int8_t USART_ReadTimeout(USART_TypeDef* USARTx, uint8_t* c, uint32_t ms) { (void) USARTx; (void) c; (void) ms; return -1; }
+
+// One-shot timers of BLE.c: the idle flush and the baud fallback
+#define TIMERS 4
+static SoftTimer* timers[TIMERS];
+static uint32_t timerDue[TIMERS];
+
+static int Timer_Slot(SoftTimer* t) {
+	int i;
+	for (i = 0; i < TIMERS; i++) {
+		if (timers[i] == t) return i;
+	}
+	return -1;
+}
+
+void SoftTimer_Start(SoftTimer* t, uint32_t ms, uint32_t period, SoftTimerCallback callback, void* context) {
+	int i = Timer_Slot(t);
+	(void) period;
+	if (i < 0) i = Timer_Slot(NULL);
+	if (i < 0) {
+		printf("FAIL: out of timer slots\n");
+		exit(1);
+	}
+	t->callback = callback;
+	t->context = context;
+	timers[i] = t;
+	timerDue[i] = now + ms;
+}
+
+void SoftTimer_Stop(SoftTimer* t) {
+	int i = Timer_Slot(t);
+	if (i >= 0) timers[i] = NULL;
+}
+
+static void Dispatch(void) {
+	SoftTimer* t;
+	int i;
+	for (i = 0; i < TIMERS; i++) {
+		t = timers[i];
+		if (t != NULL && (int32_t) (now - timerDue[i]) >= 0) {
+			timers[i] = NULL;
+			t->callback(t->context);
+		}
+	}
+}
+
+static int Timers_Armed(void) {
+	int i, armed = 0;
+	for (i = 0; i < TIMERS; i++) armed += timers[i] != NULL;
+	return armed;
+}
+
+void USART_Write(USART_TypeDef* USARTx, uint8_t* buffer, uint32_t nBytes) {
+	uint32_t i;
+	const char* text;
+	(void) USARTx;
+	if (writeCount < 64) {
+		memcpy(writes[writeCount], buffer, nBytes);
+		writes[writeCount++][nBytes] = '\0';
+	}
+	for (i = 0; i < nBytes; i++) {
+		if (i == 1 && isrText != NULL) { // interrupt arrives while the chunk is on the wire
+			text = isrText;
+			isrText = NULL;
+			ipsr = 16;
+			while (*text) BLE_Putc(*text++);
+			ipsr = 0;
+		}
+		if (moduleLen < MODULE_CAPACITY) {
+			module[moduleLen++] = buffer[i];
+		} else {
+			moduleLost++;
+		}
+		for (uint32_t t = 0; t < UART_MS_PER_BYTE; t++) Module_Tick();
+	}
+}
+
+static void Put(const char* s) {
+	while (*s) BLE_Putc(*s++);
+}
+
+static void Settle(void) {
+	uint32_t t;
+	for (t = 0; t < 2000U; t++) {
+		Module_Tick();
+		Dispatch();
+	}
+}
+
+static int failures;
+
+static void Check(int ok, const char* what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static void Reset(void) {
+	Settle();
+	airLen = 0;
+	notifications = 0;
+	writeCount = 0;
+}
+
+// A burst of report lines: everything arrives, in order, in full notifications
+static void TestBurst(void) {
+	static char expected[8192];
+	char line[64];
+	uint32_t i, len = 0;
+
+	Reset();
+	for (i = 0; i < 100; i++) {
+		snprintf(line, sizeof(line), "#%u CURRENT TEMPERATURE: %u.%02u, ELAPSED: 0:%02u:%02u\n",
+		         i, 50 + i % 40, i % 100, i % 60, (i * 7) % 60);
+		Put(line);
+		memcpy(expected + len, line, strlen(line));
+		len += strlen(line);
+	}
+	Settle();
+	Check(moduleLost == 0, "burst overflows the module buffer");
+	Check(airLen == len && memcmp(air, expected, len) == 0, "burst arrives intact and in order");
+	printf("burst: %u bytes in %u notifications, %.1f bytes each (max %u)\n",
+	       airLen, notifications, (double) airLen / notifications, BLE_MTU);
+	Check(airLen >= notifications * (BLE_MTU * 3 / 4), "notifications at least 3/4 full");
+}
+
+// A partial chunk waits for the idle time, then goes out on its own
+static void TestIdleFlush(void) {
+	uint32_t t;
+
+	Reset();
+	Put("!EVT");
+	for (t = 0; t + 1 < BLE_IDLE_FLUSH_MS; t++) {
+		Module_Tick();
+		Dispatch();
+	}
+	Check(writeCount == 0, "partial chunk held until the link is idle");
+	Check(Timers_Armed() == 1, "idle flush armed while a partial chunk waits");
+	Settle();
+	Check(writeCount == 1 && strcmp(writes[0], "!EVT") == 0, "partial chunk flushed when idle");
+	Check(Timers_Armed() == 0, "no idle flush armed with nothing queued");
+	Put("COMPLETE LINE\n");
+	Check(Timers_Armed() == 0, "no idle flush armed after a complete line went out");
+}
+
+// Output from an interrupt during a send is queued behind the chunk on the wire
+static void TestInterruptDuringSend(void) {
+	Reset();
+	isrText = "!EVT SENSOR LOST\n";
+	Put("FIRST LINE\n");
+	Settle();
+	Check(strcmp(writes[0], "FIRST LINE\n") == 0, "chunk on the wire is not split by interrupt output");
+	Check(airLen == 28 && memcmp(air, "FIRST LINE\n!EVT SENSOR LOST\n", 28) == 0, "interrupt output follows intact");
+}
+
+// An interrupt never waits for the link: a full queue drops and counts
+static void TestInterruptOverflow(void) {
+	uint32_t i, sent;
+
+	Reset();
+	sent = BLE_GetChunks();
+	ipsr = 16;
+	for (i = 0; i < BLE_TX_QUEUE + 10U; i++) BLE_Putc('x');
+	ipsr = 0;
+	Check(BLE_GetChunks() == sent, "nothing sent from interrupt context");
+	Check(BLE_GetOverflows() == 10, "characters beyond the queue counted as dropped");
+	Settle();
+	Check(airLen == BLE_TX_QUEUE && moduleLost == 0, "queued interrupt output delivered later");
+}
+
+int main(void) {
+	for (phase = 0; phase < BLE_CONN_INTERVAL_MS; phase += 7) {
+		TestBurst();
+	}
+	phase = 7;
+	TestIdleFlush();
+	TestInterruptDuringSend();
+	TestInterruptOverflow();
+	printf(failures ? "%d FAILED\n" : "PASS\n", failures);
+	return failures != 0;
+}
@@ -0,0 +1,59 @@
+#ifndef __HOST_CORE_CM4_H
+#define __HOST_CORE_CM4_H
+
+// Just enough of CMSIS core_cm4.h for firmware sources to compile on the
+// host. The intrinsics and NVIC calls are provided by each test.
+#include <stdint.h>
+
+#define __IO  volatile
+#define __I   volatile const
+#define __O   volatile
+#define __IM  volatile const
+#define __OM  volatile
+#define __IOM volatile
+#define __STATIC_INLINE static inline
+
+typedef struct { __IO uint32_t CTRL, LOAD, VAL; __I uint32_t CALIB; } SysTick_Type;
+typedef struct {
+	__I uint32_t CPUID;
+	__IO uint32_t ICSR, VTOR, AIRCR, SCR, CCR;
+	__IO uint8_t SHP[12];
+	__IO uint32_t SHCSR, CFSR, HFSR, DFSR, MMFAR, BFAR, AFSR, CPACR;
+} SCB_Type;
+typedef struct { __IO uint32_t CTRL, CYCCNT, CPICNT, EXCCNT, SLEEPCNT, LSUCNT, FOLDCNT; } DWT_Type;
+typedef struct { __IO uint32_t DHCSR, DCRSR, DCRDR, DEMCR; } CoreDebug_Type;
+
+extern SysTick_Type* SysTick;
+extern SCB_Type* SCB;
+extern DWT_Type* DWT;
+extern CoreDebug_Type* CoreDebug;
+
+#define SysTick_CTRL_CLKSOURCE_Msk  (1UL << 2)
+#define SysTick_CTRL_TICKINT_Msk    (1UL << 1)
+#define SysTick_CTRL_ENABLE_Msk     (1UL)
+#define SysTick_CTRL_COUNTFLAG_Msk  (1UL << 16)
+#define SysTick_LOAD_RELOAD_Msk     (0xFFFFFFUL)
+#define SCB_SCR_SLEEPDEEP_Msk       (1UL << 2)
+#define SCB_SCR_SLEEPONEXIT_Msk     (1UL << 1)
+#define SCB_ICSR_PENDSTSET_Msk      (1UL << 26)
+#define DWT_CTRL_CYCCNTENA_Msk      (1UL)
+#define CoreDebug_DEMCR_TRCENA_Msk  (1UL << 24)
+
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority);
+void NVIC_EnableIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+void NVIC_SetPriorityGrouping(uint32_t group);
+void NVIC_ClearPendingIRQ(IRQn_Type irq);
+void NVIC_SetPendingIRQ(IRQn_Type irq);
+
+void __WFI(void);
+void __DSB(void);
+void __ISB(void);
+void __NOP(void);
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+uint32_t __get_IPSR(void);
+
+#endif
@@ -0,0 +1 @@
+#include "stm32l476xx.h"
@@ -0,0 +1 @@
+extern uint32_t SystemCoreClock;
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Turn the !LOG lines of a DUMP into CSV.
+
+Usage: history_decode.py [dump.txt] > cook.csv
+
+Reads a console capture (other lines are ignored, several captures of a
+resumed dump can be concatenated) and writes time, Celsius, Fahrenheit
+and state per sample. The page format is described in history.c.
+"""
+import datetime
+import re
+import sys
+
+STATES = ["Rest", "Warming", "Cooking", "Paused", "Finished", "Scheduled"]
+EPOCH = datetime.datetime(2000, 1, 1)
+PAGE_SIZE = 2048
+HEADER_SIZE = 8
+LINE = re.compile(r"!LOG (\d+) (\d+) ([0-9A-Fa-f]+)\s*$")
+
+
+def read_pages(lines):
+    pages = {}
+    for line in lines:
+        m = LINE.search(line)
+        if not m:
+            continue
+        sequence, offset, data = int(m.group(1)), int(m.group(2)), bytes.fromhex(m.group(3))
+        page = pages.setdefault(sequence, bytearray(b"\xff" * PAGE_SIZE))
+        page[offset:offset + len(data)] = data
+    return pages
+
+
+def unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def decode_page(page):
+    # the first erased double-word ends the page
+    end = HEADER_SIZE
+    while end < PAGE_SIZE and page[end:end + 8] != b"\xff" * 8:
+        end += 8
+    pos = HEADER_SIZE
+    time = temp = state = None
+
+    def varint():
+        nonlocal pos
+        value = shift = 0
+        while True:
+            if pos >= end:
+                raise EOFError
+            b = page[pos]
+            pos += 1
+            value |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                return value
+
+    try:
+        while pos < end:
+            v = varint()
+            if v == 0:
+                continue
+            if v == 2:
+                time = varint()
+                temp = unzigzag(varint())
+                if pos >= end:
+                    raise EOFError
+                state = page[pos]
+                pos += 1
+                yield time, temp, state
+                continue
+            if time is None:
+                break  # page without a leading mark, cannot be placed in time
+            if v & 1:
+                for _ in range((v >> 1) + 1):
+                    time += 1
+                    yield time, temp, state
+            else:
+                time += 1
+                temp += unzigzag((v >> 1) - 1)
+                yield time, temp, state
+    except EOFError:
+        pass  # torn token at the end of a page
+
+
+def main():
+    source = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    pages = read_pages(source)
+    print("time,celsius,fahrenheit,state")
+    for sequence in sorted(pages):
+        for time, temp, state in decode_page(pages[sequence]):
+            celsius = temp / 16.0
+            stamp = EPOCH + datetime.timedelta(seconds=time)
+            name = STATES[state] if state < len(STATES) else str(state)
+            print("%s,%.4f,%.3f,%s" % (stamp.isoformat(), celsius, celsius * 9 / 5 + 32, name))
+
+
+if __name__ == "__main__":
+    main()
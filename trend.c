@@ -0,0 +1,74 @@
+#include "trend.h"
+#include "SysTimer.h"
+
+// Samples are averaged into the current bucket as they arrive, so the
+// history holds one value per column and rendering only ever looks at
+// TREND_COLUMNS values, however long the window is.
+
+static int16_t history[TREND_COLUMNS]; // bucket averages in tenths of a degree F
+static uint8_t newest;                 // index of the last completed bucket
+static uint8_t filled;                 // completed buckets, up to TREND_COLUMNS - 1
+static int32_t sum;
+static uint16_t count;
+static uint32_t lastSample, bucketStart;
+
+void Trend_Reset(void) {
+	filled = 0;
+	sum = 0;
+	count = 0;
+	bucketStart = SysTick_GetTick();
+	lastSample = bucketStart - TREND_SAMPLE_MS;
+}
+
+void Trend_Sample(double fahrenheit) {
+	uint32_t now = SysTick_GetTick();
+
+	if (now - lastSample < TREND_SAMPLE_MS) return;
+	lastSample = now;
+	sum += (int32_t) (fahrenheit * 10);
+	count++;
+
+	if (now - bucketStart >= TREND_BUCKET_MS) {
+		newest = (newest + 1) % TREND_COLUMNS;
+		history[newest] = sum / count;
+		if (filled < TREND_COLUMNS - 1) filled++;
+		sum = 0;
+		count = 0;
+		bucketStart = now;
+	}
+}
+
+// Fill out with TREND_COLUMNS bar glyphs scaled between the lowest and
+// highest value shown, oldest on the left, plus a terminating NUL
+void Trend_Render(char* out) {
+	int16_t value[TREND_COLUMNS];
+	int16_t low, high, span;
+	uint8_t n = 0, i, first;
+
+	for (i = filled; i > 0; i--) {
+		value[n++] = history[(newest + TREND_COLUMNS - i + 1) % TREND_COLUMNS];
+	}
+	if (count != 0) value[n++] = sum / count;
+
+	first = TREND_COLUMNS - n;
+	for (i = 0; i < first; i++) {
+		out[i] = ' ';
+	}
+	out[TREND_COLUMNS] = '\0';
+	if (n == 0) return;
+
+	low = high = value[0];
+	for (i = 1; i < n; i++) {
+		if (value[i] < low) low = value[i];
+		if (value[i] > high) high = value[i];
+	}
+	span = high - low;
+	if (span < TREND_MIN_SPAN) { // keep sensor noise from filling the graph
+		low -= (TREND_MIN_SPAN - span) / 2;
+		span = TREND_MIN_SPAN;
+	}
+
+	for (i = 0; i < n; i++) {
+		out[first + i] = DISPLAY_BAR(1 + (value[i] - low) * (DISPLAY_BAR_LEVELS - 1) / span);
+	}
+}
@@ -0,0 +1,18 @@
+#ifndef __STM32L476R_NUCLEO_TREND_H
+#define __STM32L476R_NUCLEO_TREND_H
+
+#include <stdint.h>
+#include "display.h"
+
+// Temperature history for the LCD sparkline: one column per bucket, the
+// newest (still filling) bucket on the right
+#define TREND_COLUMNS    DISPLAY_COLS
+#define TREND_SAMPLE_MS  1000U   // one sample per DS18B20 conversion
+#define TREND_BUCKET_MS  30000U  // 20 columns x 30 s = last 10 minutes
+#define TREND_MIN_SPAN   10      // tenths of a degree F the graph spans at least
+
+void Trend_Sample(double fahrenheit);
+void Trend_Render(char* out);
+void Trend_Reset(void);
+
+#endif